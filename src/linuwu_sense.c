@@ -19,6 +19,7 @@
  #include <linux/dmi.h>
  #include <linux/backlight.h>
  #include <linux/leds.h>
+ #include <linux/led-class-multicolor.h>
  #include <linux/platform_device.h>
  #include <linux/platform_profile.h>
  #include <linux/acpi.h>
@@ -36,6 +37,20 @@
  #include <linux/unaligned.h>
  #include <linux/bitfield.h>
  #include <linux/bitmap.h>
+ #include <linux/mutex.h>
+ #include <linux/ktime.h>
+ #include <linux/cpufreq.h>
+ #include <linux/pm_qos.h>
+ #include <linux/percpu.h>
+ #include <linux/miscdevice.h>
+ #include <linux/uaccess.h>
+ #include <linux/list.h>
+ #include <linux/sort.h>
+ #include <linux/crc32.h>
+ #include <linux/kobject.h>
+ #include <linux/reboot.h>
+ #include <linux/firmware.h>
+ #include <linux/completion.h>
  
  MODULE_AUTHOR("Carlos Corbacho");
  MODULE_DESCRIPTION("Acer Laptop WMI Extras Driver");
@@ -110,8 +125,6 @@
  /*
   * Predator State
   */
- #define STATE_FILE "/etc/predator_state" 
- #define KB_STATE_FILE "/etc/four_zone_kb_state"
  /*
   * Acer ACPI event GUIDs
   */
@@ -336,6 +349,9 @@ enum acer_wmi_predator_v4_oc {
  static bool predator_v4;
  static bool nitro_v4;
  static u64 supported_sensors;
+ static unsigned int profile_resync_interval;
+ static unsigned int stats_sample_interval = 10;
+ static bool kb_merge_zones;
  
  module_param(mailled, int, 0444);
  module_param(brightness, int, 0444);
@@ -346,6 +362,9 @@ enum acer_wmi_predator_v4_oc {
  module_param(cycle_gaming_thermal_profile, bool, 0644);
  module_param(predator_v4, bool, 0444);
  module_param(nitro_v4, bool, 0444);
+ module_param(profile_resync_interval, uint, 0444);
+ module_param(stats_sample_interval, uint, 0444);
+ module_param(kb_merge_zones, bool, 0644);
  MODULE_PARM_DESC(mailled, "Set initial state of Mail LED");
  MODULE_PARM_DESC(brightness, "Set initial LCD backlight brightness");
  MODULE_PARM_DESC(threeg, "Set initial state of 3G hardware");
@@ -358,6 +377,12 @@ enum acer_wmi_predator_v4_oc {
      "Enable features for predator laptops that use predator sense v4");
  MODULE_PARM_DESC(nitro_v4,
     "Enable features for nitro laptops that use nitro sense v4");
+ MODULE_PARM_DESC(profile_resync_interval,
+    "Seconds between reconciling the cached thermal profile with firmware (0 = disabled)");
+ MODULE_PARM_DESC(stats_sample_interval,
+    "Seconds between fan and temperature samples for the profile statistics (0 = disabled)");
+ MODULE_PARM_DESC(kb_merge_zones,
+    "Write keyboard zones sharing a color with a single combined zone mask");
  
  struct acer_data {
      int mailled;
@@ -947,6 +972,17 @@ enum acer_wmi_predator_v4_oc {
 
   /* The most performant supported profile */
   static int acer_predator_v4_max_perf;
+
+ /*
+  * The thermal profile last written to (or read from) the firmware.
+  * Every path that changes the profile updates it, so platform_profile
+  * reads are served from memory. -1 means unknown, forcing a WMI read.
+  * Only touched under acer_gaming_lock, so a resync can't overwrite a
+  * fresh write with a stale read.
+  */
+ static int acer_cached_tp = -1;
+ /* Last known power source, 1 on AC, 0 on battery, -1 if unknown */
+ static int acer_on_ac = -1;
  
  enum acer_predator_v4_thermal_profile {
     ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET		= 0x00,
@@ -1806,7 +1842,7 @@ enum acer_wmi_predator_v4_oc {
      return 0;
  }
 
- static void WMID_gaming_set_fan_mode(u8 fan_mode)
+ static acpi_status WMID_gaming_set_fan_mode(u8 fan_mode)
  {
      /* fan_mode = 1 is used for auto, fan_mode = 2 used for turbo*/
      u64 gpu_fan_config1 = 0, gpu_fan_config2 = 0;
@@ -1824,7 +1860,7 @@ enum acer_wmi_predator_v4_oc {
          gpu_fan_config1 |= fan_mode << (2 * i + 2);
      for (i = 0; i < quirks->gpu_fans; ++i)
          gpu_fan_config1 |= fan_mode << (2 * i + 6);
-     WMID_gaming_set_u64(gpu_fan_config2 | gpu_fan_config1 << 16, ACER_CAP_TURBO_FAN);
+     return WMID_gaming_set_u64(gpu_fan_config2 | gpu_fan_config1 << 16, ACER_CAP_TURBO_FAN);
  }
 
  static int WMID_gaming_set_misc_setting(enum acer_wmi_gaming_misc_setting setting, u8 value)
@@ -2096,6 +2132,30 @@ enum acer_wmi_predator_v4_oc {
  }
  /* Fan Speed */
  static acpi_status acer_set_fan_speed(int t_cpu_fan_speed, int t_gpu_fan_speed);
+ static int cpu_fan_speed;
+ static int gpu_fan_speed;
+ static int lcd_override_state;
+ static int usb_charging_state;
+ static int __acer_thermal_profile_read(u8 *tp);
+ static int acer_thermal_profile_read(u8 *tp);
+ static int acer_thermal_profile_write(u8 tp);
+ static void acer_profile_qos_apply(u8 tp);
+ static void acer_stats_set_profile(u8 tp);
+ static void acer_state_restore_wait(void);
+ static void acer_state_mark_dirty(void);
+ static void four_zone_effect_stop(void);
+ static void kb_leds_seed(void);
+ static void kb_idle_fn(struct work_struct *work);
+ static DECLARE_DELAYED_WORK(kb_idle_work, kb_idle_fn);
+ static void acer_wmi_hwmon_sample_fn(struct work_struct *work);
+ static DECLARE_DELAYED_WORK(acer_wmi_hwmon_sample_work, acer_wmi_hwmon_sample_fn);
+ static unsigned long acer_wmi_hwmon_interval = 1000;
+ static void acer_wmi_hwmon_sample_start(void);
+ static void acer_wmi_hwmon_sample_stop(void);
+ static int acer_wmi_temp_read(int channel, long *temp);
+ static int acer_wmi_fan_read(int channel, long *rpm);
+ static acpi_status acer_lcd_override_set(int val);
+ static acpi_status acer_usb_charging_set(int val);
  
 //  static int acer_get_fan_speed(int fan) {
 //      if (quirks->predator_v4 || quirks->nitro_sense) {
@@ -2116,60 +2176,334 @@ enum acer_wmi_predator_v4_oc {
 //      return -EOPNOTSUPP;
 //  }
  
+ /*
+  * Gaming state transactions
+  *
+  * Writes that belong together (profile + fans, turbo LED + fan mode + OC)
+  * are queued into a transaction and applied back to back while holding
+  * acer_gaming_lock. Every step's status is checked. On the first failure
+  * the failed step and the ones before it are undone in reverse order,
+  * using the values snapshotted under the lock right before applying.
+  */
+ static DEFINE_MUTEX(acer_gaming_lock);
+ 
+ /*
+  * Last turbo LED and fan mode values written, -1 if unknown. The firmware
+  * has no getter for the fan mode, so these are what rollbacks go back to.
+  * Protected by acer_gaming_lock.
+  */
+ static int acer_turbo_led_state = -1;
+ static int acer_fan_mode_state = -1;
+ 
+ enum acer_txn_op_type {
+     ACER_TXN_PROFILE,
+     ACER_TXN_FAN_SPEED,
+     ACER_TXN_TURBO_LED,
+     ACER_TXN_FAN_MODE,
+     ACER_TXN_MISC_SETTING,
+     ACER_TXN_LCD_OVERRIDE,
+     ACER_TXN_USB_CHARGING,
+ };
+ 
+ #define ACER_TXN_MAX_OPS 8
+ 
+ struct acer_txn_op {
+     enum acer_txn_op_type type;
+     u8 index;       /* misc setting index for ACER_TXN_MISC_SETTING */
+     int val[2];     /* value to apply */
+     int old[2];     /* snapshot taken at commit, old[0] < 0 if unknown */
+     bool cond;      /* only apply while the snapshot still equals expect */
+     int expect[2];
+ };
+ 
+ struct acer_gaming_txn {
+     const char *name;
+     bool persist;   /* a user change, mark the saved state dirty on success */
+     int nr_ops;
+     int err;
+     struct acer_txn_op ops[ACER_TXN_MAX_OPS];
+ };
+ 
+ struct acer_txn_stats {
+     u64 count;
+     u64 rollbacks;
+     u64 last_us;
+     u64 max_us;
+ };
+ 
+ static struct acer_txn_stats acer_txn_stats;
+ 
+ #define ACER_GAMING_TXN(_name) { .name = (_name) }
+ #define ACER_GAMING_TXN_USER(_name) { .name = (_name), .persist = true }
+ 
+ static void acer_txn_add(struct acer_gaming_txn *txn, enum acer_txn_op_type type,
+                          u8 index, int val0, int val1)
+ {
+     struct acer_txn_op *op;
+ 
+     if (txn->nr_ops >= ACER_TXN_MAX_OPS) {
+         txn->err = -ENOSPC;
+         return;
+     }
+ 
+     op = &txn->ops[txn->nr_ops++];
+     op->type = type;
+     op->index = index;
+     op->val[0] = val0;
+     op->val[1] = val1;
+     op->cond = false;
+ }
+ 
+ /* Queue a step that is skipped if the current value is no longer expect0/1 */
+ static void acer_txn_add_if(struct acer_gaming_txn *txn, enum acer_txn_op_type type,
+                             u8 index, int val0, int val1, int expect0, int expect1)
+ {
+     struct acer_txn_op *op;
+ 
+     acer_txn_add(txn, type, index, val0, val1);
+     if (txn->err)
+         return;
+ 
+     op = &txn->ops[txn->nr_ops - 1];
+     op->cond = true;
+     op->expect[0] = expect0;
+     op->expect[1] = expect1;
+ }
+ 
+ static void acer_txn_add_profile(struct acer_gaming_txn *txn, u8 tp)
+ {
+     acer_txn_add(txn, ACER_TXN_PROFILE, 0, tp, 0);
+ }
+ 
+ static void acer_txn_add_fan_speed(struct acer_gaming_txn *txn, int cpu, int gpu)
+ {
+     acer_txn_add(txn, ACER_TXN_FAN_SPEED, 0, cpu, gpu);
+ }
+ 
+ /*
+  * Record what @op is about to overwrite, from the shadow copies where the
+  * driver keeps one and from the firmware otherwise.
+  */
+ static void acer_txn_snapshot_op(struct acer_txn_op *op)
+ {
+     u64 led;
+     u8 val;
+ 
+     lockdep_assert_held(&acer_gaming_lock);
+ 
+     op->old[0] = -1;
+     op->old[1] = 0;
+ 
+     switch (op->type) {
+     case ACER_TXN_PROFILE:
+         if (!__acer_thermal_profile_read(&val))
+             op->old[0] = val;
+         break;
+     case ACER_TXN_FAN_SPEED:
+         op->old[0] = cpu_fan_speed;
+         op->old[1] = gpu_fan_speed;
+         break;
+     case ACER_TXN_TURBO_LED:
+         if (acer_turbo_led_state < 0 &&
+             ACPI_SUCCESS(WMID_gaming_get_u64(&led, ACER_CAP_TURBO_LED)))
+             acer_turbo_led_state = led ? 0x10001 : 0x1;
+         op->old[0] = acer_turbo_led_state;
+         break;
+     case ACER_TXN_FAN_MODE:
+         op->old[0] = acer_fan_mode_state;
+         break;
+     case ACER_TXN_MISC_SETTING:
+         if (!WMID_gaming_get_misc_setting(op->index, &val))
+             op->old[0] = val;
+         break;
+     case ACER_TXN_LCD_OVERRIDE:
+         op->old[0] = lcd_override_state;
+         break;
+     case ACER_TXN_USB_CHARGING:
+         op->old[0] = usb_charging_state;
+         break;
+     }
+ }
+ 
+ static int acer_txn_apply_op(const struct acer_txn_op *op, const int *v)
+ {
+     switch (op->type) {
+     case ACER_TXN_PROFILE:
+         return acer_thermal_profile_write(v[0]);
+     case ACER_TXN_FAN_SPEED:
+         return ACPI_FAILURE(acer_set_fan_speed(v[0], v[1])) ? -EIO : 0;
+     case ACER_TXN_TURBO_LED:
+         if (ACPI_FAILURE(WMID_gaming_set_u64(v[0], ACER_CAP_TURBO_LED))) {
+             acer_turbo_led_state = -1;
+             return -EIO;
+         }
+         acer_turbo_led_state = v[0];
+         return 0;
+     case ACER_TXN_FAN_MODE:
+         if (ACPI_FAILURE(WMID_gaming_set_fan_mode(v[0]))) {
+             acer_fan_mode_state = -1;
+             return -EIO;
+         }
+         acer_fan_mode_state = v[0];
+         return 0;
+     case ACER_TXN_MISC_SETTING:
+         return WMID_gaming_set_misc_setting(op->index, v[0]);
+     case ACER_TXN_LCD_OVERRIDE:
+         return ACPI_FAILURE(acer_lcd_override_set(v[0])) ? -EIO : 0;
+     case ACER_TXN_USB_CHARGING:
+         return ACPI_FAILURE(acer_usb_charging_set(v[0])) ? -EIO : 0;
+     }
+ 
+     return -EINVAL;
+ }
+ 
+ static int acer_txn_commit(struct acer_gaming_txn *txn)
+ {
+     ktime_t start;
+     u64 elapsed;
+     int i, err = 0;
+ 
+     if (txn->err)
+         return txn->err;
+ 
+     mutex_lock(&acer_gaming_lock);
+     start = ktime_get();
+ 
+     /* Snapshot everything first, before any step changes a shadow */
+     for (i = 0; i < txn->nr_ops; i++)
+         acer_txn_snapshot_op(&txn->ops[i]);
+ 
+     for (i = 0; i < txn->nr_ops; i++) {
+         struct acer_txn_op *op = &txn->ops[i];
+ 
+         if (op->cond && (op->old[0] != op->expect[0] || op->old[1] != op->expect[1])) {
+             /* Changed by someone else since, leave it and don't roll it back */
+             op->old[0] = -1;
+             continue;
+         }
+         err = acer_txn_apply_op(op, op->val);
+         if (err)
+             break;
+     }
+ 
+     if (err) {
+         pr_err("%s: step %d failed (%d), rolling back\n", txn->name, i, err);
+         /* The failed step may have been half applied, so undo it too */
+         for (; i >= 0; i--) {
+             if (txn->ops[i].old[0] < 0)
+                 continue;
+             if (acer_txn_apply_op(&txn->ops[i], txn->ops[i].old))
+                 pr_err("%s: rollback of step %d failed\n", txn->name, i);
+         }
+         acer_txn_stats.rollbacks++;
+     }
+ 
+     elapsed = ktime_us_delta(ktime_get(), start);
+     acer_txn_stats.count++;
+     acer_txn_stats.last_us = elapsed;
+     acer_txn_stats.max_us = max(acer_txn_stats.max_us, elapsed);
+     mutex_unlock(&acer_gaming_lock);
+ 
+     pr_debug("%s: %d steps in %llu us\n", txn->name, txn->nr_ops, elapsed);
+ 
+     if (!err && txn->persist)
+         acer_state_mark_dirty();
+ 
+     return err;
+ }
+ 
  /*
   *  Predator series turbo button
   */
  static int acer_toggle_turbo(void)
  {
+     struct acer_gaming_txn txn = ACER_GAMING_TXN("turbo toggle");
      u64 turbo_led_state;
+     int led, fan_mode, oc;
+ 
+     acer_state_restore_wait();
  
      /* Get current state from turbo button */
      if (ACPI_FAILURE(WMID_gaming_get_u64(&turbo_led_state, ACER_CAP_TURBO_LED)))
          return -1;
  
      if (turbo_led_state) {
-         /* Turn off turbo led */
-         WMID_gaming_set_u64(0x1, ACER_CAP_TURBO_LED);
- 
-         /* Set FAN mode to auto */
-         WMID_gaming_set_fan_mode(0x1);
- 
-         /* Set OC to normal */
-         if (has_cap(ACER_CAP_TURBO_OC)) {
-             WMID_gaming_set_misc_setting(ACER_WMID_MISC_SETTING_OC_1,
-                              ACER_WMID_OC_NORMAL);
-             WMID_gaming_set_misc_setting(ACER_WMID_MISC_SETTING_OC_2,
-                              ACER_WMID_OC_NORMAL);
-         }
+         /* Turbo led off, FAN mode auto, OC normal */
+         led = 0x1;
+         fan_mode = 0x1;
+         oc = ACER_WMID_OC_NORMAL;
      } else {
-         /* Turn on turbo led */
-         WMID_gaming_set_u64(0x10001, ACER_CAP_TURBO_LED);
- 
-         /* Set FAN mode to turbo */
-         WMID_gaming_set_fan_mode(0x2);
- 
-         /* Set OC to turbo mode */
-         if (has_cap(ACER_CAP_TURBO_OC)) {
-             WMID_gaming_set_misc_setting(ACER_WMID_MISC_SETTING_OC_1,
-                              ACER_WMID_OC_TURBO);
-             WMID_gaming_set_misc_setting(ACER_WMID_MISC_SETTING_OC_2,
-                              ACER_WMID_OC_TURBO);
-         }
+         /* Turbo led on, FAN mode turbo, OC turbo */
+         led = 0x10001;
+         fan_mode = 0x2;
+         oc = ACER_WMID_OC_TURBO;
+     }
+ 
+     acer_txn_add(&txn, ACER_TXN_TURBO_LED, 0, led, 0);
+     acer_txn_add(&txn, ACER_TXN_FAN_MODE, 0, fan_mode, 0);
+     if (has_cap(ACER_CAP_TURBO_OC)) {
+         acer_txn_add(&txn, ACER_TXN_MISC_SETTING, ACER_WMID_MISC_SETTING_OC_1, oc, 0);
+         acer_txn_add(&txn, ACER_TXN_MISC_SETTING, ACER_WMID_MISC_SETTING_OC_2, oc, 0);
      }
+ 
+     if (acer_txn_commit(&txn))
+         return -1;
+ 
      return turbo_led_state;
  }
  
- static int
- acer_predator_v4_platform_profile_get(struct device *dev,
-                       enum platform_profile_option *profile)
+ static int __acer_thermal_profile_read(u8 *tp)
  {
-     u8 tp;
      int err;
  
-     err = WMID_gaming_get_misc_setting(ACER_WMID_MISC_SETTING_PLATFORM_PROFILE, &tp);
+     lockdep_assert_held(&acer_gaming_lock);
+ 
+     if (acer_cached_tp >= 0) {
+         *tp = acer_cached_tp;
+         return 0;
+     }
+ 
+     err = WMID_gaming_get_misc_setting(ACER_WMID_MISC_SETTING_PLATFORM_PROFILE, tp);
      if (err)
          return err;
  
+     acer_cached_tp = *tp;
+     return 0;
+ }
+ 
+ static int acer_thermal_profile_read(u8 *tp)
+ {
+     int err;
+ 
+     mutex_lock(&acer_gaming_lock);
+     err = __acer_thermal_profile_read(tp);
+     mutex_unlock(&acer_gaming_lock);
+ 
+     return err;
+ }
+ 
+ /* Only called from acer_txn_apply_op(), with acer_gaming_lock held */
+ static int acer_thermal_profile_write(u8 tp)
+ {
+     int err;
+ 
+     lockdep_assert_held(&acer_gaming_lock);
+ 
+     err = WMID_gaming_set_misc_setting(ACER_WMID_MISC_SETTING_PLATFORM_PROFILE, tp);
+     if (err) {
+         /* The firmware may or may not have taken it, read it back next time */
+         acer_cached_tp = -1;
+         return err;
+     }
+ 
+     acer_cached_tp = tp;
+     acer_profile_qos_apply(tp);
+     acer_stats_set_profile(tp);
+     return 0;
+ }
+ 
+ static int acer_predator_v4_tp_to_profile(u8 tp, enum platform_profile_option *profile)
+ {
      switch (tp) {
      case ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO:
          *profile = PLATFORM_PROFILE_PERFORMANCE;
@@ -2193,1891 +2527,5060 @@ enum acer_wmi_predator_v4_oc {
      return 0;
  }
  
- static int
- acer_predator_v4_platform_profile_set(struct device *dev,
-                       enum platform_profile_option profile)
+ static int acer_predator_v4_profile_to_tp(enum platform_profile_option profile, int *tp)
  {
-     int err,tp;
-     acpi_status status;
-     u64 on_AC;
- 
-     /* Check Power Source */
-     status = WMI_gaming_execute_u64(
-         ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
-         ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS, &on_AC);
- 
-     if (ACPI_FAILURE(status))
-         return -EIO;
- 
-     /* Check power source */
-     /* Blocking these modes since in official version this is not supported when its not plugged in AC! */
-     if(!on_AC && (profile == PLATFORM_PROFILE_PERFORMANCE || profile == PLATFORM_PROFILE_BALANCED_PERFORMANCE || profile == PLATFORM_PROFILE_QUIET)){
-         return -EOPNOTSUPP;
-     }
- 
-     /* turn the fan down i mean its quiet mode | eco mode after all*/
-     if(profile == PLATFORM_PROFILE_QUIET || profile == PLATFORM_PROFILE_LOW_POWER) {
-         acpi_status stat = acer_set_fan_speed(0,0);
-         if(ACPI_FAILURE(stat)){
-             return -EIO;
-         }
-     }
- 
      switch (profile) {
      case PLATFORM_PROFILE_PERFORMANCE:
-         tp = ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO;
+         *tp = ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO;
          break;
      case PLATFORM_PROFILE_BALANCED_PERFORMANCE:
-         tp = ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE;
+         *tp = ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE;
          break;
      case PLATFORM_PROFILE_BALANCED:
-         tp = ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED;
+         *tp = ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED;
          break;
      case PLATFORM_PROFILE_QUIET:
-         tp = ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET;
+         *tp = ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET;
          break;
      case PLATFORM_PROFILE_LOW_POWER:
-         tp = ACER_PREDATOR_V4_THERMAL_PROFILE_ECO;
+         *tp = ACER_PREDATOR_V4_THERMAL_PROFILE_ECO;
          break;
      default:
          return -EOPNOTSUPP;
      }
  
-     err = WMID_gaming_set_misc_setting(ACER_WMID_MISC_SETTING_PLATFORM_PROFILE, tp);
-     if (err)
-         return err;
- 
-     if (tp != acer_predator_v4_max_perf)
-         last_non_turbo_profile = tp;
- 
      return 0;
  }
  
- static int
- acer_predator_v4_platform_profile_probe(void *drvdata, unsigned long *choices)
+ /*
+  * Per-profile CPU frequency caps
+  *
+  * The thermal profiles only change the EC power limits. Each platform profile
+  * can also carry a cpufreq max frequency, applied through freq_qos on every
+  * profile change so the CPU stops boosting into the thermal limit on quiet
+  * and eco. 0 means no cap.
+  *
+  * There is one request per cpufreq policy. A policy notifier adds it when
+  * the policy is created and drops it before the policy goes away, so CPUs
+  * that come online later and cpufreq drivers that load after us are
+  * capped too.
+  */
+ static const char * const acer_profile_qos_names[] = {
+     [PLATFORM_PROFILE_LOW_POWER]            = "low-power",
+     [PLATFORM_PROFILE_QUIET]                = "quiet",
+     [PLATFORM_PROFILE_BALANCED]             = "balanced",
+     [PLATFORM_PROFILE_BALANCED_PERFORMANCE] = "balanced-performance",
+     [PLATFORM_PROFILE_PERFORMANCE]          = "performance",
+ };
+ 
+ static unsigned int acer_profile_freq_cap[ARRAY_SIZE(acer_profile_qos_names)]; /* kHz */
+ 
+ struct acer_freq_qos {
+     struct list_head node;
+     struct cpufreq_policy *policy;
+     struct freq_qos_request req;
+ };
+ 
+ /* acer_freq_qos_list and acer_freq_qos_khz are protected by acer_freq_qos_lock */
+ static LIST_HEAD(acer_freq_qos_list);
+ static DEFINE_MUTEX(acer_freq_qos_lock);
+ static s32 acer_freq_qos_khz = FREQ_QOS_MAX_DEFAULT_VALUE;
+ static bool acer_freq_qos_ready;
+ 
+ static void acer_freq_qos_add(struct cpufreq_policy *policy)
  {
-     unsigned long supported_profiles;
-     int err;
+     struct acer_freq_qos *qos;
+     int ret;
  
-     err = WMID_gaming_get_misc_setting(ACER_WMID_MISC_SETTING_SUPPORTED_PROFILES,
-                        (u8 *)&supported_profiles);
-     if (err)
-         return err;
+     lockdep_assert_held(&acer_freq_qos_lock);
  
-     /* Iterate through supported profiles in order of increasing performance */
-     if (test_bit(ACER_PREDATOR_V4_THERMAL_PROFILE_ECO, &supported_profiles)) {
-         set_bit(PLATFORM_PROFILE_LOW_POWER, choices);
-         acer_predator_v4_max_perf = ACER_PREDATOR_V4_THERMAL_PROFILE_ECO;
-         last_non_turbo_profile = ACER_PREDATOR_V4_THERMAL_PROFILE_ECO;
-     }
+     list_for_each_entry(qos, &acer_freq_qos_list, node)
+         if (qos->policy == policy)
+             return;
  
-     if (test_bit(ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET, &supported_profiles)) {
-         set_bit(PLATFORM_PROFILE_QUIET, choices);
-         acer_predator_v4_max_perf = ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET;
-         last_non_turbo_profile = ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET;
-     }
+     qos = kzalloc(sizeof(*qos), GFP_KERNEL);
+     if (!qos)
+         return;
  
-     if (test_bit(ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED, &supported_profiles)) {
-         set_bit(PLATFORM_PROFILE_BALANCED, choices);
-         acer_predator_v4_max_perf = ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED;
-         last_non_turbo_profile = ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED;
+     ret = freq_qos_add_request(&policy->constraints, &qos->req, FREQ_QOS_MAX,
+                                acer_freq_qos_khz);
+     if (ret < 0) {
+         pr_warn("Failed to add freq_qos request for cpu %d: %d\n", policy->cpu, ret);
+         kfree(qos);
+         return;
      }
  
-     if (test_bit(ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE, &supported_profiles)) {
-         set_bit(PLATFORM_PROFILE_BALANCED_PERFORMANCE, choices);
-         acer_predator_v4_max_perf = ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE;
+     qos->policy = policy;
+     list_add_tail(&qos->node, &acer_freq_qos_list);
+ }
  
-         /* We only use this profile as a fallback option in case no prior
-          * profile is supported.
-          */
-         if (last_non_turbo_profile < 0)
-             last_non_turbo_profile = ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE;
-     }
+ static void acer_freq_qos_remove(struct cpufreq_policy *policy)
+ {
+     struct acer_freq_qos *qos, *tmp;
  
-     if (test_bit(ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO, &supported_profiles)) {
-         set_bit(PLATFORM_PROFILE_PERFORMANCE, choices);
-         acer_predator_v4_max_perf = ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO;
+     lockdep_assert_held(&acer_freq_qos_lock);
  
-         /* We need to handle the hypothetical case where only the turbo profile
-          * is supported. In this case the turbo toggle will essentially be a
-          * no-op.
-          */
-         if (last_non_turbo_profile < 0)
-             last_non_turbo_profile = ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO;
+     list_for_each_entry_safe(qos, tmp, &acer_freq_qos_list, node) {
+         if (policy && qos->policy != policy)
+             continue;
+         freq_qos_remove_request(&qos->req);
+         list_del(&qos->node);
+         kfree(qos);
      }
- 
-     return 0;
  }
  
- static int acer_predator_state_update(int value);
+ static int acer_freq_qos_notify(struct notifier_block *nb, unsigned long event, void *data)
+ {
+     struct cpufreq_policy *policy = data;
  
- static acpi_status acer_predator_state_restore(int value);
+     mutex_lock(&acer_freq_qos_lock);
+     if (acer_freq_qos_ready) {
+         if (event == CPUFREQ_CREATE_POLICY)
+             acer_freq_qos_add(policy);
+         else if (event == CPUFREQ_REMOVE_POLICY)
+             acer_freq_qos_remove(policy);
+     }
+     mutex_unlock(&acer_freq_qos_lock);
  
- static acpi_status battery_health_set(u8 function, u8 function_status);
+     return NOTIFY_OK;
+ }
  
- static const struct platform_profile_ops acer_predator_v4_platform_profile_ops = {
-     .probe = acer_predator_v4_platform_profile_probe,
-     .profile_get = acer_predator_v4_platform_profile_get,
-     .profile_set = acer_predator_v4_platform_profile_set,
+ static struct notifier_block acer_freq_qos_nb = {
+     .notifier_call = acer_freq_qos_notify,
  };
  
- static int acer_platform_profile_setup(struct platform_device *pdev)
+ static void acer_profile_qos_apply(u8 tp)
  {
-     const int max_retries = 10;
-     int delay_ms = 100;
-     if (!quirks->predator_v4 && !quirks->nitro_sense && !quirks->nitro_v4)
-         return 0;
-     for (int attempt = 1; attempt <= max_retries; attempt++) {
-         platform_profile_device = devm_platform_profile_register(
-             &pdev->dev, "acer-wmi", NULL, &acer_predator_v4_platform_profile_ops);
-         if (!IS_ERR(platform_profile_device)) {
-             platform_profile_support = true;
-             pr_info("Platform profile registered successfully (attempt %d)\n", attempt);
-             return 0;
-         }
-         pr_warn("Platform profile registration failed (attempt %d/%d), error: %ld\n",
-                 attempt, max_retries, PTR_ERR(platform_profile_device));
-         if (attempt < max_retries) {
-             msleep(delay_ms);
-             delay_ms = min(delay_ms * 2, 1000);
-         }
-     }
-     pr_warn("Platform profile setup failed. Continuing to load without profile support.\n");
-     platform_profile_support = false; /* Disable platform profile support if unavailable. */
-     
-     return 0;
+     enum platform_profile_option profile;
+     s32 khz = FREQ_QOS_MAX_DEFAULT_VALUE;
+     struct acer_freq_qos *qos;
+ 
+     if (!acer_predator_v4_tp_to_profile(tp, &profile) &&
+         profile < ARRAY_SIZE(acer_profile_freq_cap) && acer_profile_freq_cap[profile])
+         khz = acer_profile_freq_cap[profile];
+ 
+     /* Remembered so policies created later start with the current cap */
+     mutex_lock(&acer_freq_qos_lock);
+     acer_freq_qos_khz = khz;
+     list_for_each_entry(qos, &acer_freq_qos_list, node)
+         freq_qos_update_request(&qos->req, khz);
+     mutex_unlock(&acer_freq_qos_lock);
  }
  
- static int acer_thermal_profile_change(void)
+ static void acer_profile_qos_init(void)
  {
+     struct cpufreq_policy *policy;
+     int cpu, ret;
+     u8 tp;
+ 
+     mutex_lock(&acer_freq_qos_lock);
+     acer_freq_qos_ready = true;
+     mutex_unlock(&acer_freq_qos_lock);
+ 
+     ret = cpufreq_register_notifier(&acer_freq_qos_nb, CPUFREQ_POLICY_NOTIFIER);
+     if (ret) {
+         pr_warn("Failed to register cpufreq notifier: %d\n", ret);
+         mutex_lock(&acer_freq_qos_lock);
+         acer_freq_qos_ready = false;
+         mutex_unlock(&acer_freq_qos_lock);
+         return;
+     }
+ 
      /*
-      * This mode key can rotate each mode or toggle turbo mode.
-      * On battery, only ECO and BALANCED mode are available.
+      * Pick up the policies that already exist. The lock is held across
+      * the lookup, so a policy going away waits in the notifier until its
+      * request is on the list and gets removed with it.
       */
-     if (quirks->predator_v4 || quirks->nitro_sense || quirks->nitro_v4) {
-         u8 current_tp;
-         int tp, err;
-         u64 on_AC;
-         acpi_status status;
-         err = WMID_gaming_get_misc_setting(ACER_WMID_MISC_SETTING_PLATFORM_PROFILE, &current_tp);
-         if (err)
-             return err;
-         /* Check power source */
-         status = WMI_gaming_execute_u64(
-             ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
-             ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS, &on_AC);
-         
-         if (ACPI_FAILURE(status))
-             return -EIO;
-         
-         /* On AC - define next profile transitions */
-         if (!on_AC) {
-            if (current_tp == ACER_PREDATOR_V4_THERMAL_PROFILE_ECO)
-                tp = ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED;
-            else
-                tp = ACER_PREDATOR_V4_THERMAL_PROFILE_ECO;
-        } else {
-            switch (current_tp) {
-            case ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO:
-                tp = cycle_gaming_thermal_profile
-                     ? ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET
-                     : last_non_turbo_profile;
-                break;
-            case ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE:
-                tp = (acer_predator_v4_max_perf == current_tp)
-                     ? last_non_turbo_profile
-                     : acer_predator_v4_max_perf;
-                break;
-            case ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED:
-                tp = cycle_gaming_thermal_profile
-                     ? ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE
-                     : acer_predator_v4_max_perf;
-                break;
-            case ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET:
-                tp = cycle_gaming_thermal_profile
-                     ? ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED
-                     : acer_predator_v4_max_perf;
-                break;
-            case ACER_PREDATOR_V4_THERMAL_PROFILE_ECO:
-                tp = cycle_gaming_thermal_profile
-                     ? ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET
-                     : acer_predator_v4_max_perf;
-                break;
-            default:
-                return -EOPNOTSUPP;
-            }
-        }
-
-         err = WMID_gaming_set_misc_setting(ACER_WMID_MISC_SETTING_PLATFORM_PROFILE, tp);
-         if (err)
-             return err;
+     mutex_lock(&acer_freq_qos_lock);
+     for_each_possible_cpu(cpu) {
+         policy = cpufreq_cpu_get(cpu);
+         if (!policy)
+             continue;
+         acer_freq_qos_add(policy);
+         cpufreq_cpu_put(policy);
+     }
+     if (list_empty(&acer_freq_qos_list))
+         pr_info("No cpufreq policy yet, frequency caps apply once one is created\n");
+     mutex_unlock(&acer_freq_qos_lock);
+ 
+     /* Under the gaming lock, so a profile write cannot apply its cap first */
+     mutex_lock(&acer_gaming_lock);
+     if (!__acer_thermal_profile_read(&tp))
+         acer_profile_qos_apply(tp);
+     mutex_unlock(&acer_gaming_lock);
+ }
  
-         /* the quiter you become the more you'll be able to hear! */
-         if(tp == ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET || tp == ACER_PREDATOR_V4_THERMAL_PROFILE_ECO) {
-             acpi_status stat = acer_set_fan_speed(0,0);
-             if(ACPI_FAILURE(stat)){
-                 return -EIO;
-             }
-         }
-         /* Store non-turbo profile for turbo mode toggle*/
-         if (tp != acer_predator_v4_max_perf)
-             last_non_turbo_profile = tp;
+ static void acer_profile_qos_exit(void)
+ {
+     bool ready;
  
-         platform_profile_notify(platform_profile_device);
-     }
+     mutex_lock(&acer_freq_qos_lock);
+     ready = acer_freq_qos_ready;
+     acer_freq_qos_ready = false;
+     acer_freq_qos_remove(NULL);
+     mutex_unlock(&acer_freq_qos_lock);
  
-     return 0;
+     if (ready)
+         cpufreq_unregister_notifier(&acer_freq_qos_nb, CPUFREQ_POLICY_NOTIFIER);
  }
  
  /*
-  * Switch series keyboard dock status
+  * Profile residency and thermal statistics
+  *
+  * Time spent in each platform profile on AC and on battery, and histograms
+  * of the fan and temperature readings taken while in that profile. Shown in
+  * debugfs under acer-wmi/stats/<profile>/, in the spirit of cpuidle state
+  * stats. Writing to acer-wmi/stats/reset clears everything.
+  *
+  * The readings come from a work that samples the CPU and GPU sensors every
+  * stats_sample_interval seconds, so the histograms weigh each profile by
+  * time and do not depend on how often userspace polls hwmon.
   */
- static int acer_kbd_dock_state_to_sw_tablet_mode(u8 kbd_dock_state)
- {
-     switch (kbd_dock_state) {
-     case 0x01: /* Docked, traditional clamshell laptop mode */
-         return 0;
-     case 0x04: /* Stand-alone tablet */
-     case 0x40: /* Docked, tent mode, keyboard not usable */
-         return 1;
-     default:
-         pr_warn("Unknown kbd_dock_state 0x%02x\n", kbd_dock_state);
-     }
+ #define ACER_STATS_FAN_BUCKETS      8   /* 1000 rpm each, last is open ended */
+ #define ACER_STATS_FAN_BUCKET_RPM   1000
+ #define ACER_STATS_TEMP_BUCKETS     8   /* <40, 40-49 ... 90-99, >=100 C */
+ #define ACER_STATS_TEMP_BASE        40
+ #define ACER_STATS_TEMP_STEP        10
+ 
+ enum acer_stats_power {
+     ACER_STATS_BATTERY,
+     ACER_STATS_AC,
+     ACER_STATS_POWER_MAX,
+ };
  
-     return 0;
- }
+ enum acer_stats_sensor {
+     ACER_STATS_CPU_FAN,
+     ACER_STATS_GPU_FAN,
+     ACER_STATS_CPU_TEMP,
+     ACER_STATS_GPU_TEMP,
+     ACER_STATS_SENSOR_MAX,
+ };
  
- static void acer_kbd_dock_get_initial_state(void)
- {
-     u8 *output, input[8] = { 0x05, 0x00, };
-     struct acpi_buffer input_buf = { sizeof(input), input };
-     struct acpi_buffer output_buf = { ACPI_ALLOCATE_BUFFER, NULL };
-     union acpi_object *obj;
-     acpi_status status;
-     int sw_tablet_mode;
+ struct acer_profile_stats {
+     u64 time_ns[ACER_STATS_POWER_MAX];
+     u64 usage[ACER_STATS_POWER_MAX];
+     u32 hist[ACER_STATS_SENSOR_MAX][ACER_STATS_FAN_BUCKETS];
+ };
  
-     status = wmi_evaluate_method(WMID_GUID3, 0, 0x2, &input_buf, &output_buf);
-     if (ACPI_FAILURE(status)) {
-         pr_err("Error getting keyboard-dock initial status: %s\n",
-                acpi_format_exception(status));
-         return;
-     }
+ static_assert(ACER_STATS_FAN_BUCKETS == ACER_STATS_TEMP_BUCKETS);
  
-     obj = output_buf.pointer;
-     if (!obj || obj->type != ACPI_TYPE_BUFFER || obj->buffer.length != 8) {
-         pr_err("Unexpected output format getting keyboard-dock initial status\n");
-         goto out_free_obj;
-     }
+ static struct acer_profile_stats acer_stats[ARRAY_SIZE(acer_profile_qos_names)];
+ static DEFINE_SPINLOCK(acer_stats_lock);
+ static int acer_stats_profile = -1;
+ static int acer_stats_power = -1;
+ static ktime_t acer_stats_since;
  
-     output = obj->buffer.pointer;
-     if (output[0] != 0x00 || (output[3] != 0x05 && output[3] != 0x45)) {
-         pr_err("Unexpected output [0]=0x%02x [3]=0x%02x getting keyboard-dock initial status\n",
-                output[0], output[3]);
-         goto out_free_obj;
-     }
+ /* Close the running interval and start a new one, acer_stats_lock held */
+ static void acer_stats_switch(int profile, int power)
+ {
+     ktime_t now = ktime_get_boottime();
  
-     sw_tablet_mode = acer_kbd_dock_state_to_sw_tablet_mode(output[4]);
-     input_report_switch(acer_wmi_input_dev, SW_TABLET_MODE, sw_tablet_mode);
+     if (acer_stats_profile >= 0 && acer_stats_power >= 0)
+         acer_stats[acer_stats_profile].time_ns[acer_stats_power] +=
+             ktime_to_ns(ktime_sub(now, acer_stats_since));
  
- out_free_obj:
-     kfree(obj);
+     if (profile >= 0 && power >= 0 &&
+         (profile != acer_stats_profile || power != acer_stats_power))
+         acer_stats[profile].usage[power]++;
+ 
+     acer_stats_profile = profile;
+     acer_stats_power = power;
+     acer_stats_since = now;
  }
  
- static void acer_kbd_dock_event(const struct event_return_value *event)
+ static void acer_stats_set_profile(u8 tp)
  {
-     int sw_tablet_mode;
+     enum platform_profile_option profile;
  
-     if (!has_cap(ACER_CAP_KBD_DOCK))
+     if (acer_predator_v4_tp_to_profile(tp, &profile) || profile >= ARRAY_SIZE(acer_stats))
          return;
  
-     sw_tablet_mode = acer_kbd_dock_state_to_sw_tablet_mode(event->kbd_dock_state);
-     input_report_switch(acer_wmi_input_dev, SW_TABLET_MODE, sw_tablet_mode);
-     input_sync(acer_wmi_input_dev);
+     spin_lock(&acer_stats_lock);
+     if (profile != acer_stats_profile)
+         acer_stats_switch(profile, acer_stats_power);
+     spin_unlock(&acer_stats_lock);
  }
  
- /*
-  * Rfkill devices
-  */
- static void acer_rfkill_update(struct work_struct *ignored);
- static DECLARE_DELAYED_WORK(acer_rfkill_work, acer_rfkill_update);
- static void acer_rfkill_update(struct work_struct *ignored)
+ static void acer_stats_set_power(bool on_ac)
  {
-     u32 state;
-     acpi_status status;
- 
-     if (has_cap(ACER_CAP_WIRELESS)) {
-         status = get_u32(&state, ACER_CAP_WIRELESS);
-         if (ACPI_SUCCESS(status)) {
-             if (quirks->wireless == 3)
-                 rfkill_set_hw_state(wireless_rfkill, !state);
-             else
-                 rfkill_set_sw_state(wireless_rfkill, !state);
-         }
-     }
+     int power = on_ac ? ACER_STATS_AC : ACER_STATS_BATTERY;
  
-     if (has_cap(ACER_CAP_BLUETOOTH)) {
-         status = get_u32(&state, ACER_CAP_BLUETOOTH);
-         if (ACPI_SUCCESS(status))
-             rfkill_set_sw_state(bluetooth_rfkill, !state);
-     }
+     spin_lock(&acer_stats_lock);
+     if (power != acer_stats_power)
+         acer_stats_switch(acer_stats_profile, power);
+     spin_unlock(&acer_stats_lock);
+ }
  
-     if (has_cap(ACER_CAP_THREEG) && wmi_has_guid(WMID_GUID3)) {
-         status = get_u32(&state, ACER_WMID3_GDS_THREEG);
-         if (ACPI_SUCCESS(status))
-             rfkill_set_sw_state(threeg_rfkill, !state);
-     }
+ static void acer_stats_sample(enum acer_stats_sensor sensor, long val)
+ {
+     int bucket;
  
-     schedule_delayed_work(&acer_rfkill_work, round_jiffies_relative(HZ));
+     if (sensor == ACER_STATS_CPU_FAN || sensor == ACER_STATS_GPU_FAN)
+         bucket = val / ACER_STATS_FAN_BUCKET_RPM;
+     else
+         bucket = val < ACER_STATS_TEMP_BASE ? 0 :
+              (val - ACER_STATS_TEMP_BASE) / ACER_STATS_TEMP_STEP + 1;
+     bucket = clamp(bucket, 0, ACER_STATS_FAN_BUCKETS - 1);
+ 
+     spin_lock(&acer_stats_lock);
+     if (acer_stats_profile >= 0)
+         acer_stats[acer_stats_profile].hist[sensor][bucket]++;
+     spin_unlock(&acer_stats_lock);
  }
  
- static int acer_rfkill_set(void *data, bool blocked)
+ static bool acer_stats_sampling;
+ 
+ static void acer_stats_sample_fn(struct work_struct *work);
+ static DECLARE_DELAYED_WORK(acer_stats_sample_work, acer_stats_sample_fn);
+ static void acer_stats_sample_fn(struct work_struct *work)
  {
-     acpi_status status;
-     u32 cap = (unsigned long)data;
+     long val;
  
-     if (rfkill_inited) {
-         status = set_u32(!blocked, cap);
-         if (ACPI_FAILURE(status))
-             return -ENODEV;
+     for (int i = 0; i < 2; i++) {
+         if (!acer_wmi_temp_read(i, &val))
+             acer_stats_sample(ACER_STATS_CPU_TEMP + i, val);
+         if (!acer_wmi_fan_read(i, &val))
+             acer_stats_sample(ACER_STATS_CPU_FAN + i, val);
      }
  
-     return 0;
+     schedule_delayed_work(&acer_stats_sample_work,
+                           round_jiffies_relative(stats_sample_interval * HZ));
  }
  
- static const struct rfkill_ops acer_rfkill_ops = {
-     .set_block = acer_rfkill_set,
- };
- 
- static struct rfkill *acer_rfkill_register(struct device *dev,
-                        enum rfkill_type type,
-                        char *name, u32 cap)
+ static void acer_stats_init(void)
  {
-     int err;
-     struct rfkill *rfkill_dev;
-     u32 state;
      acpi_status status;
+     u64 on_AC;
+     u8 tp;
  
-     rfkill_dev = rfkill_alloc(name, dev, type,
-                   &acer_rfkill_ops,
-                   (void *)(unsigned long)cap);
-     if (!rfkill_dev)
-         return ERR_PTR(-ENOMEM);
- 
-     status = get_u32(&state, cap);
+     status = WMI_gaming_execute_u64(ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
+                                     ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS, &on_AC);
+     if (ACPI_SUCCESS(status))
+         acer_stats_set_power(on_AC);
+     if (!acer_thermal_profile_read(&tp))
+         acer_stats_set_profile(tp);
  
-     err = rfkill_register(rfkill_dev);
-     if (err) {
-         rfkill_destroy(rfkill_dev);
-         return ERR_PTR(err);
+     if (supported_sensors && stats_sample_interval) {
+         acer_stats_sampling = true;
+         schedule_delayed_work(&acer_stats_sample_work,
+                               round_jiffies_relative(stats_sample_interval * HZ));
      }
+ }
  
-     if (ACPI_SUCCESS(status))
-         rfkill_set_sw_state(rfkill_dev, !state);
- 
-     return rfkill_dev;
+ static int acer_stats_time_show(struct seq_file *m, void *v)
+ {
+     int profile = (long)m->private;
+     u64 time_ns[ACER_STATS_POWER_MAX], usage[ACER_STATS_POWER_MAX];
+ 
+     spin_lock(&acer_stats_lock);
+     memcpy(time_ns, acer_stats[profile].time_ns, sizeof(time_ns));
+     memcpy(usage, acer_stats[profile].usage, sizeof(usage));
+     /* Include the interval that is still running */
+     if (profile == acer_stats_profile && acer_stats_power >= 0)
+         time_ns[acer_stats_power] +=
+             ktime_to_ns(ktime_sub(ktime_get_boottime(), acer_stats_since));
+     spin_unlock(&acer_stats_lock);
+ 
+     seq_printf(m, "ac_time_ms %llu\nac_usage %llu\n",
+                div_u64(time_ns[ACER_STATS_AC], NSEC_PER_MSEC), usage[ACER_STATS_AC]);
+     seq_printf(m, "battery_time_ms %llu\nbattery_usage %llu\n",
+                div_u64(time_ns[ACER_STATS_BATTERY], NSEC_PER_MSEC), usage[ACER_STATS_BATTERY]);
+     return 0;
  }
+ DEFINE_SHOW_ATTRIBUTE(acer_stats_time);
  
- static int acer_rfkill_init(struct device *dev)
+ static int acer_stats_hist_show(struct seq_file *m, void *v)
  {
-     int err;
+     static const char * const sensor_names[] = {
+         [ACER_STATS_CPU_FAN]  = "cpu_fan_rpm",
+         [ACER_STATS_GPU_FAN]  = "gpu_fan_rpm",
+         [ACER_STATS_CPU_TEMP] = "cpu_temp",
+         [ACER_STATS_GPU_TEMP] = "gpu_temp",
+     };
+     int profile = (long)m->private;
+     u32 hist[ACER_STATS_SENSOR_MAX][ACER_STATS_FAN_BUCKETS];
  
-     if (has_cap(ACER_CAP_WIRELESS)) {
-         wireless_rfkill = acer_rfkill_register(dev, RFKILL_TYPE_WLAN,
-             "acer-wireless", ACER_CAP_WIRELESS);
-         if (IS_ERR(wireless_rfkill)) {
-             err = PTR_ERR(wireless_rfkill);
-             goto error_wireless;
-         }
-     }
+     spin_lock(&acer_stats_lock);
+     memcpy(hist, acer_stats[profile].hist, sizeof(hist));
+     spin_unlock(&acer_stats_lock);
  
-     if (has_cap(ACER_CAP_BLUETOOTH)) {
-         bluetooth_rfkill = acer_rfkill_register(dev,
-             RFKILL_TYPE_BLUETOOTH, "acer-bluetooth",
-             ACER_CAP_BLUETOOTH);
-         if (IS_ERR(bluetooth_rfkill)) {
-             err = PTR_ERR(bluetooth_rfkill);
-             goto error_bluetooth;
-         }
+     for (int s = 0; s < ACER_STATS_SENSOR_MAX; s++) {
+         seq_printf(m, "%-12s", sensor_names[s]);
+         for (int b = 0; b < ACER_STATS_FAN_BUCKETS; b++)
+             seq_printf(m, " %u", hist[s][b]);
+         seq_putc(m, '\n');
      }
+     return 0;
+ }
+ DEFINE_SHOW_ATTRIBUTE(acer_stats_hist);
  
-     if (has_cap(ACER_CAP_THREEG)) {
-         threeg_rfkill = acer_rfkill_register(dev,
-             RFKILL_TYPE_WWAN, "acer-threeg",
-             ACER_CAP_THREEG);
-         if (IS_ERR(threeg_rfkill)) {
-             err = PTR_ERR(threeg_rfkill);
-             goto error_threeg;
-         }
-     }
+ static ssize_t acer_stats_reset_write(struct file *file, const char __user *buf,
+                                       size_t count, loff_t *ppos)
+ {
+     spin_lock(&acer_stats_lock);
+     memset(acer_stats, 0, sizeof(acer_stats));
+     acer_stats_since = ktime_get_boottime();
+     spin_unlock(&acer_stats_lock);
  
-     rfkill_inited = true;
+     return count;
+ }
  
-     if ((ec_raw_mode || !wmi_has_guid(ACERWMID_EVENT_GUID)) &&
-         has_cap(ACER_CAP_WIRELESS | ACER_CAP_BLUETOOTH | ACER_CAP_THREEG))
-         schedule_delayed_work(&acer_rfkill_work,
-             round_jiffies_relative(HZ));
+ static const struct file_operations acer_stats_reset_fops = {
+     .write = acer_stats_reset_write,
+     .llseek = noop_llseek,
+ };
  
-     return 0;
+ static void acer_stats_debugfs_init(struct dentry *parent)
+ {
+     struct dentry *root, *dir;
  
- error_threeg:
-     if (has_cap(ACER_CAP_BLUETOOTH)) {
-         rfkill_unregister(bluetooth_rfkill);
-         rfkill_destroy(bluetooth_rfkill);
-     }
- error_bluetooth:
-     if (has_cap(ACER_CAP_WIRELESS)) {
-         rfkill_unregister(wireless_rfkill);
-         rfkill_destroy(wireless_rfkill);
+     root = debugfs_create_dir("stats", parent);
+     for (long i = 0; i < ARRAY_SIZE(acer_profile_qos_names); i++) {
+         if (!acer_profile_qos_names[i])
+             continue;
+         dir = debugfs_create_dir(acer_profile_qos_names[i], root);
+         debugfs_create_file("time", 0444, dir, (void *)i, &acer_stats_time_fops);
+         debugfs_create_file("histogram", 0444, dir, (void *)i, &acer_stats_hist_fops);
      }
- error_wireless:
-     return err;
+     debugfs_create_file("reset", 0200, root, NULL, &acer_stats_reset_fops);
  }
  
- static void acer_rfkill_exit(void)
+ static ssize_t profile_freq_cap_show(struct device *dev, struct device_attribute *attr, char *buf)
  {
-     if ((ec_raw_mode || !wmi_has_guid(ACERWMID_EVENT_GUID)) &&
-         has_cap(ACER_CAP_WIRELESS | ACER_CAP_BLUETOOTH | ACER_CAP_THREEG))
-         cancel_delayed_work_sync(&acer_rfkill_work);
- 
-     if (has_cap(ACER_CAP_WIRELESS)) {
-         rfkill_unregister(wireless_rfkill);
-         rfkill_destroy(wireless_rfkill);
-     }
+     int len = 0;
  
-     if (has_cap(ACER_CAP_BLUETOOTH)) {
-         rfkill_unregister(bluetooth_rfkill);
-         rfkill_destroy(bluetooth_rfkill);
+     for (int i = 0; i < ARRAY_SIZE(acer_profile_qos_names); i++) {
+         if (!acer_profile_qos_names[i])
+             continue;
+         len += sysfs_emit_at(buf, len, "%s %u\n", acer_profile_qos_names[i],
+                              READ_ONCE(acer_profile_freq_cap[i]));
      }
  
-     if (has_cap(ACER_CAP_THREEG)) {
-         rfkill_unregister(threeg_rfkill);
-         rfkill_destroy(threeg_rfkill);
-     }
+     return len;
  }
  
- static void acer_wmi_notify(union acpi_object *obj, void *context)
+ static ssize_t profile_freq_cap_store(struct device *dev, struct device_attribute *attr,
+                                       const char *buf, size_t count)
  {
-     struct event_return_value return_value;
-     u16 device_state;
-     const struct key_entry *key;
-     u32 scancode;
+     char name[24];
+     unsigned int khz;
+     u8 tp;
+     int i;
  
-     if (!obj)
-         return;
-     if (obj->type != ACPI_TYPE_BUFFER) {
-         pr_warn("Unknown response received %d\n", obj->type);
+     /* <profile> <max kHz> */
+     if (sscanf(buf, "%23s %u", name, &khz) != 2 || khz > FREQ_QOS_MAX_DEFAULT_VALUE)
+         return -EINVAL;
+ 
+     for (i = 0; i < ARRAY_SIZE(acer_profile_qos_names); i++)
+         if (acer_profile_qos_names[i] && !strcmp(acer_profile_qos_names[i], name))
+             break;
+     if (i == ARRAY_SIZE(acer_profile_qos_names))
+         return -EINVAL;
+ 
+     WRITE_ONCE(acer_profile_freq_cap[i], khz);
+ 
+     /* Takes effect right away if this is the active profile */
+     mutex_lock(&acer_gaming_lock);
+     if (!__acer_thermal_profile_read(&tp))
+         acer_profile_qos_apply(tp);
+     mutex_unlock(&acer_gaming_lock);
+ 
+     return count;
+ }
+ 
+ static int
+ acer_predator_v4_platform_profile_get(struct device *dev,
+                       enum platform_profile_option *profile)
+ {
+     u8 tp;
+     int err;
+ 
+     err = acer_thermal_profile_read(&tp);
+     if (err)
+         return err;
+ 
+     return acer_predator_v4_tp_to_profile(tp, profile);
+ }
+ 
+ static int
+ acer_predator_v4_platform_profile_set(struct device *dev,
+                       enum platform_profile_option profile)
+ {
+     struct acer_gaming_txn txn = ACER_GAMING_TXN_USER("platform profile");
+     int err,tp;
+     acpi_status status;
+     u64 on_AC;
+ 
+     acer_state_restore_wait();
+ 
+     /* Check Power Source */
+     status = WMI_gaming_execute_u64(
+         ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
+         ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS, &on_AC);
+ 
+     if (ACPI_FAILURE(status))
+         return -EIO;
+ 
+     /* Check power source */
+     /* Blocking these modes since in official version this is not supported when its not plugged in AC! */
+     if(!on_AC && (profile == PLATFORM_PROFILE_PERFORMANCE || profile == PLATFORM_PROFILE_BALANCED_PERFORMANCE || profile == PLATFORM_PROFILE_QUIET)){
+         return -EOPNOTSUPP;
+     }
+ 
+     err = acer_predator_v4_profile_to_tp(profile, &tp);
+     if (err)
+         return err;
+ 
+     /* turn the fan down i mean its quiet mode | eco mode after all*/
+     if (profile == PLATFORM_PROFILE_QUIET || profile == PLATFORM_PROFILE_LOW_POWER)
+         acer_txn_add_fan_speed(&txn, 0, 0);
+     acer_txn_add_profile(&txn, tp);
+ 
+     err = acer_txn_commit(&txn);
+     if (err)
+         return err;
+ 
+     if (tp != acer_predator_v4_max_perf)
+         last_non_turbo_profile = tp;
+ 
+     return 0;
+ }
+ 
+ static int
+ acer_predator_v4_platform_profile_probe(void *drvdata, unsigned long *choices)
+ {
+     unsigned long supported_profiles;
+     int err;
+ 
+     err = WMID_gaming_get_misc_setting(ACER_WMID_MISC_SETTING_SUPPORTED_PROFILES,
+                        (u8 *)&supported_profiles);
+     if (err)
+         return err;
+ 
+     /* Iterate through supported profiles in order of increasing performance */
+     if (test_bit(ACER_PREDATOR_V4_THERMAL_PROFILE_ECO, &supported_profiles)) {
+         set_bit(PLATFORM_PROFILE_LOW_POWER, choices);
+         acer_predator_v4_max_perf = ACER_PREDATOR_V4_THERMAL_PROFILE_ECO;
+         last_non_turbo_profile = ACER_PREDATOR_V4_THERMAL_PROFILE_ECO;
+     }
+ 
+     if (test_bit(ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET, &supported_profiles)) {
+         set_bit(PLATFORM_PROFILE_QUIET, choices);
+         acer_predator_v4_max_perf = ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET;
+         last_non_turbo_profile = ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET;
+     }
+ 
+     if (test_bit(ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED, &supported_profiles)) {
+         set_bit(PLATFORM_PROFILE_BALANCED, choices);
+         acer_predator_v4_max_perf = ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED;
+         last_non_turbo_profile = ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED;
+     }
+ 
+     if (test_bit(ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE, &supported_profiles)) {
+         set_bit(PLATFORM_PROFILE_BALANCED_PERFORMANCE, choices);
+         acer_predator_v4_max_perf = ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE;
+ 
+         /* We only use this profile as a fallback option in case no prior
+          * profile is supported.
+          */
+         if (last_non_turbo_profile < 0)
+             last_non_turbo_profile = ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE;
+     }
+ 
+     if (test_bit(ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO, &supported_profiles)) {
+         set_bit(PLATFORM_PROFILE_PERFORMANCE, choices);
+         acer_predator_v4_max_perf = ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO;
+ 
+         /* We need to handle the hypothetical case where only the turbo profile
+          * is supported. In this case the turbo toggle will essentially be a
+          * no-op.
+          */
+         if (last_non_turbo_profile < 0)
+             last_non_turbo_profile = ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO;
+     }
+ 
+     return 0;
+ }
+ 
+ static int acer_predator_state_update(int value);
+ 
+ static acpi_status acer_predator_state_restore(int value);
+ 
+ /*
+  * Serializes state blob applies and reads with the AC switch, the paths that
+  * update current_states.
+  */
+ static DEFINE_MUTEX(acer_state_apply_lock);
+ 
+ static acpi_status battery_health_set(u8 function, u8 function_status);
+ 
+ static const struct platform_profile_ops acer_predator_v4_platform_profile_ops = {
+     .probe = acer_predator_v4_platform_profile_probe,
+     .profile_get = acer_predator_v4_platform_profile_get,
+     .profile_set = acer_predator_v4_platform_profile_set,
+ };
+ 
+ /*
+  * Optional reconciliation of the cached profile with firmware, to catch
+  * changes made behind the driver's back (e.g. by the EC itself).
+  */
+ static void acer_profile_resync(struct work_struct *work);
+ static DECLARE_DELAYED_WORK(acer_profile_resync_work, acer_profile_resync);
+ static void acer_profile_resync(struct work_struct *work)
+ {
+     bool changed = false;
+     u8 tp;
+     int err;
+ 
+     /*
+      * Read and compare under the lock, so a profile write can't land
+      * between the firmware read and the cache update.
+      */
+     mutex_lock(&acer_gaming_lock);
+     err = WMID_gaming_get_misc_setting(ACER_WMID_MISC_SETTING_PLATFORM_PROFILE, &tp);
+     if (!err && tp != acer_cached_tp) {
+         pr_info("thermal profile changed outside the driver: %d -> %d\n",
+                 acer_cached_tp, tp);
+         acer_cached_tp = tp;
+         acer_profile_qos_apply(tp);
+         acer_stats_set_profile(tp);
+         changed = true;
+     }
+     mutex_unlock(&acer_gaming_lock);
+ 
+     if (changed && platform_profile_support)
+         platform_profile_notify(platform_profile_device);
+ 
+     schedule_delayed_work(&acer_profile_resync_work,
+                           round_jiffies_relative(profile_resync_interval * HZ));
+ }
+ 
+ /*
+  * Platform profile registration. The first attempt is made from probe, if it
+  * fails the retries run from a delayed work with the same backoff (100 ms
+  * doubling up to 1 s) so probe never sleeps. Everything that depends on the
+  * profile is started once registration succeeds.
+  */
+ #define ACER_PROFILE_REGISTER_RETRIES 10
+ 
+ static struct platform_device *acer_profile_pdev;
+ static int acer_profile_attempt;
+ 
+ static void acer_stats_init(void);
+ static void acer_boost_init(void);
+ 
+ static void acer_platform_profile_ready(void)
+ {
+     acer_profile_qos_init();
+     if (profile_resync_interval)
+         schedule_delayed_work(&acer_profile_resync_work,
+                               round_jiffies_relative(profile_resync_interval * HZ));
+     acer_stats_init();
+     acer_boost_init();
+ }
+ 
+ static bool acer_platform_profile_try_register(void)
+ {
+     struct device *dev;
+ 
+     acer_profile_attempt++;
+     dev = devm_platform_profile_register(&acer_profile_pdev->dev, "acer-wmi", NULL,
+                                          &acer_predator_v4_platform_profile_ops);
+     if (IS_ERR(dev)) {
+         pr_warn("Platform profile registration failed (attempt %d/%d), error: %ld\n",
+                 acer_profile_attempt, ACER_PROFILE_REGISTER_RETRIES, PTR_ERR(dev));
+         return false;
+     }
+ 
+     platform_profile_device = dev;
+     platform_profile_support = true;
+     pr_info("Platform profile registered successfully (attempt %d)\n", acer_profile_attempt);
+     acer_platform_profile_ready();
+     return true;
+ }
+ 
+ static void acer_platform_profile_register_fn(struct work_struct *work);
+ static DECLARE_DELAYED_WORK(acer_profile_register_work, acer_platform_profile_register_fn);
+ 
+ static void acer_platform_profile_retry(void)
+ {
+     unsigned int delay_ms;
+ 
+     if (acer_profile_attempt >= ACER_PROFILE_REGISTER_RETRIES) {
+         pr_warn("Platform profile setup failed. Continuing without profile support.\n");
          return;
      }
-     if (obj->buffer.length != 8) {
-         pr_warn("Unknown buffer length %d\n", obj->buffer.length);
-         return;
+ 
+     delay_ms = min(100U << (acer_profile_attempt - 1), 1000U);
+     schedule_delayed_work(&acer_profile_register_work, msecs_to_jiffies(delay_ms));
+ }
+ 
+ static void acer_platform_profile_register_fn(struct work_struct *work)
+ {
+     if (!acer_platform_profile_try_register())
+         acer_platform_profile_retry();
+ }
+ 
+ static int acer_platform_profile_setup(struct platform_device *pdev)
+ {
+     if (!quirks->predator_v4 && !quirks->nitro_sense && !quirks->nitro_v4)
+         return 0;
+ 
+     acer_profile_pdev = pdev;
+     acer_profile_attempt = 0;
+     if (!acer_platform_profile_try_register())
+         acer_platform_profile_retry();
+ 
+     return 0;
+ }
+ 
+ static int acer_thermal_profile_change(void)
+ {
+     /*
+      * This mode key can rotate each mode or toggle turbo mode.
+      * On battery, only ECO and BALANCED mode are available.
+      */
+     if (quirks->predator_v4 || quirks->nitro_sense || quirks->nitro_v4) {
+         struct acer_gaming_txn txn = ACER_GAMING_TXN_USER("thermal profile cycle");
+         u8 current_tp;
+         int tp, err;
+         u64 on_AC;
+         acpi_status status;
+ 
+         acer_state_restore_wait();
+         err = acer_thermal_profile_read(&current_tp);
+         if (err)
+             return err;
+         /* Check power source */
+         status = WMI_gaming_execute_u64(
+             ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
+             ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS, &on_AC);
+         
+         if (ACPI_FAILURE(status))
+             return -EIO;
+         
+         /* On AC - define next profile transitions */
+         if (!on_AC) {
+            if (current_tp == ACER_PREDATOR_V4_THERMAL_PROFILE_ECO)
+                tp = ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED;
+            else
+                tp = ACER_PREDATOR_V4_THERMAL_PROFILE_ECO;
+        } else {
+            switch (current_tp) {
+            case ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO:
+                tp = cycle_gaming_thermal_profile
+                     ? ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET
+                     : last_non_turbo_profile;
+                break;
+            case ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE:
+                tp = (acer_predator_v4_max_perf == current_tp)
+                     ? last_non_turbo_profile
+                     : acer_predator_v4_max_perf;
+                break;
+            case ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED:
+                tp = cycle_gaming_thermal_profile
+                     ? ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE
+                     : acer_predator_v4_max_perf;
+                break;
+            case ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET:
+                tp = cycle_gaming_thermal_profile
+                     ? ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED
+                     : acer_predator_v4_max_perf;
+                break;
+            case ACER_PREDATOR_V4_THERMAL_PROFILE_ECO:
+                tp = cycle_gaming_thermal_profile
+                     ? ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET
+                     : acer_predator_v4_max_perf;
+                break;
+            default:
+                return -EOPNOTSUPP;
+            }
+        }
+
+         acer_txn_add_profile(&txn, tp);
+         /* the quiter you become the more you'll be able to hear! */
+         if (tp == ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET || tp == ACER_PREDATOR_V4_THERMAL_PROFILE_ECO)
+             acer_txn_add_fan_speed(&txn, 0, 0);
+ 
+         err = acer_txn_commit(&txn);
+         if (err)
+             return err;
+ 
+         /* Store non-turbo profile for turbo mode toggle*/
+         if (tp != acer_predator_v4_max_perf)
+             last_non_turbo_profile = tp;
+ 
+         platform_profile_notify(platform_profile_device);
+     }
+ 
+     return 0;
+ }
+ 
+ /*
+  * Performance boost leases
+  *
+  * /dev/acer-boost hands out time limited leases on a platform profile and a
+  * fan floor. Each open file holds at most one lease, renewed by issuing the
+  * ioctl again. While any lease is held the strongest profile and the highest
+  * floor win. When the last lease expires, is released or its file is closed,
+  * the profile and fan speeds from before the first lease are restored.
+  */
+ struct acer_boost_lease {
+     __u32 profile;      /* enum platform_profile_option */
+     __u32 fan_floor;    /* percent, 0 leaves the fans alone */
+     __u32 duration;     /* seconds */
+ };
+ 
+ #define ACER_BOOST_IOC_LEASE    _IOW('A', 0x01, struct acer_boost_lease)
+ #define ACER_BOOST_IOC_RELEASE  _IO('A', 0x02)
+ #define ACER_BOOST_MAX_DURATION (24 * 60 * 60)
+ 
+ struct acer_boost_holder {
+     struct list_head node;
+     enum platform_profile_option profile;
+     int fan_floor;
+     unsigned long expires;
+     bool active;
+ };
+ 
+ static LIST_HEAD(acer_boost_holders);
+ static DEFINE_MUTEX(acer_boost_lock);
+ static bool acer_boost_engaged;
+ /* What was there before the first lease */
+ static int acer_boost_base_tp;
+ static int acer_boost_base_cpu_fan;
+ static int acer_boost_base_gpu_fan;
+ /* What the leases last wrote, -1 until a write succeeds */
+ static int acer_boost_set_tp = -1;
+ static int acer_boost_set_cpu_fan = -1;
+ static int acer_boost_set_gpu_fan = -1;
+ 
+ static void acer_boost_expire(struct work_struct *work);
+ static DECLARE_DELAYED_WORK(acer_boost_work, acer_boost_expire);
+ 
+ /* Recompute the combined lease and drive the hardware, acer_boost_lock held */
+ static int acer_boost_update(void)
+ {
+     struct acer_gaming_txn txn = ACER_GAMING_TXN("boost lease");
+     enum platform_profile_option profile = PLATFORM_PROFILE_LOW_POWER;
+     struct acer_boost_holder *h;
+     unsigned long next = 0;
+     int tp, cpu_fan, gpu_fan, floor = 0, nr_active = 0;
+     bool profile_changed;
+     u8 cur_tp;
+     int err;
+ 
+     list_for_each_entry(h, &acer_boost_holders, node) {
+         if (h->active && time_after_eq(jiffies, h->expires))
+             h->active = false;
+         if (!h->active)
+             continue;
+         if (!nr_active++ || time_before(h->expires, next))
+             next = h->expires;
+         profile = max(profile, h->profile);
+         floor = max(floor, h->fan_floor);
+     }
+ 
+     if (!nr_active) {
+         if (!acer_boost_engaged)
+             return 0;
+         cancel_delayed_work(&acer_boost_work);
+         acer_boost_engaged = false;
+         /*
+          * Only put back what still shows the lease. A profile or fan speed
+          * the user picked while it was held is left alone.
+          */
+         acer_txn_add_if(&txn, ACER_TXN_PROFILE, 0, acer_boost_base_tp, 0,
+                         acer_boost_set_tp, 0);
+         acer_txn_add_if(&txn, ACER_TXN_FAN_SPEED, 0, acer_boost_base_cpu_fan,
+                         acer_boost_base_gpu_fan, acer_boost_set_cpu_fan,
+                         acer_boost_set_gpu_fan);
+         acer_boost_set_tp = acer_boost_set_cpu_fan = acer_boost_set_gpu_fan = -1;
+ 
+         err = acer_txn_commit(&txn);
+         if (err)
+             return err;
+ 
+         if (platform_profile_support)
+             platform_profile_notify(platform_profile_device);
+         pr_debug("boost: all leases ended\n");
+         return 0;
+     }
+ 
+     if (!acer_boost_engaged) {
+         err = acer_thermal_profile_read(&cur_tp);
+         if (err)
+             return err;
+         acer_boost_base_tp = cur_tp;
+         acer_boost_base_cpu_fan = cpu_fan_speed;
+         acer_boost_base_gpu_fan = gpu_fan_speed;
+         acer_boost_engaged = true;
+     }
+     err = acer_predator_v4_profile_to_tp(profile, &tp);
+     if (err)
+         return err;
+     cpu_fan = max(acer_boost_base_cpu_fan, floor);
+     gpu_fan = max(acer_boost_base_gpu_fan, floor);
+     mod_delayed_work(system_wq, &acer_boost_work,
+                      time_after(next, jiffies) ? next - jiffies : 0);
+ 
+     profile_changed = acer_thermal_profile_read(&cur_tp) || cur_tp != tp;
+     if (profile_changed)
+         acer_txn_add_profile(&txn, tp);
+     if (cpu_fan != cpu_fan_speed || gpu_fan != gpu_fan_speed)
+         acer_txn_add_fan_speed(&txn, cpu_fan, gpu_fan);
+ 
+     err = acer_txn_commit(&txn);
+     if (err)
+         return err;
+ 
+     acer_boost_set_tp = tp;
+     acer_boost_set_cpu_fan = cpu_fan;
+     acer_boost_set_gpu_fan = gpu_fan;
+ 
+     if (profile_changed && platform_profile_support)
+         platform_profile_notify(platform_profile_device);
+ 
+     pr_debug("boost: %d active lease(s), profile %d, fans %d,%d\n",
+              nr_active, tp, cpu_fan, gpu_fan);
+     return 0;
+ }
+ 
+ /*
+  * The profile and fan speeds to save while a lease holds: the ones from
+  * before it, unless the user changed them after the lease set them.
+  */
+ static void acer_boost_saved_state(int *tp, int *cpu_fan, int *gpu_fan)
+ {
+     mutex_lock(&acer_boost_lock);
+     if (acer_boost_engaged) {
+         if (*tp == acer_boost_set_tp)
+             *tp = acer_boost_base_tp;
+         if (*cpu_fan == acer_boost_set_cpu_fan && *gpu_fan == acer_boost_set_gpu_fan) {
+             *cpu_fan = acer_boost_base_cpu_fan;
+             *gpu_fan = acer_boost_base_gpu_fan;
+         }
+     }
+     mutex_unlock(&acer_boost_lock);
+ }
+ 
+ static void acer_boost_expire(struct work_struct *work)
+ {
+     mutex_lock(&acer_boost_lock);
+     if (acer_boost_update())
+         pr_err("Failed to update boost leases\n");
+     mutex_unlock(&acer_boost_lock);
+ }
+ 
+ static int acer_boost_lease(struct acer_boost_holder *h, const struct acer_boost_lease *req)
+ {
+     acpi_status status;
+     u64 on_AC;
+     int tp, err;
+ 
+     if (acer_predator_v4_profile_to_tp(req->profile, &tp))
+         return -EINVAL;
+     if (req->fan_floor > 100 || !req->duration || req->duration > ACER_BOOST_MAX_DURATION)
+         return -EINVAL;
+ 
+     /* Same restriction as the platform profile: no high profiles on battery */
+     status = WMI_gaming_execute_u64(ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
+                                     ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS, &on_AC);
+     if (ACPI_FAILURE(status))
+         return -EIO;
+     if (!on_AC && tp != ACER_PREDATOR_V4_THERMAL_PROFILE_ECO &&
+         tp != ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED)
+         return -EOPNOTSUPP;
+ 
+     acer_state_restore_wait();
+ 
+     mutex_lock(&acer_boost_lock);
+     h->profile = req->profile;
+     h->fan_floor = req->fan_floor;
+     h->expires = jiffies + req->duration * HZ;
+     h->active = true;
+     err = acer_boost_update();
+     if (err) {
+         h->active = false;
+         acer_boost_update();
+     }
+     mutex_unlock(&acer_boost_lock);
+ 
+     return err;
+ }
+ 
+ static void acer_boost_release(struct acer_boost_holder *h)
+ {
+     mutex_lock(&acer_boost_lock);
+     if (h->active) {
+         h->active = false;
+         if (acer_boost_update())
+             pr_err("Failed to restore settings after boost lease\n");
+     }
+     mutex_unlock(&acer_boost_lock);
+ }
+ 
+ static int acer_boost_open(struct inode *inode, struct file *file)
+ {
+     struct acer_boost_holder *h;
+ 
+     h = kzalloc(sizeof(*h), GFP_KERNEL);
+     if (!h)
+         return -ENOMEM;
+ 
+     mutex_lock(&acer_boost_lock);
+     list_add(&h->node, &acer_boost_holders);
+     mutex_unlock(&acer_boost_lock);
+ 
+     file->private_data = h;
+     return 0;
+ }
+ 
+ static int acer_boost_file_release(struct inode *inode, struct file *file)
+ {
+     struct acer_boost_holder *h = file->private_data;
+ 
+     acer_boost_release(h);
+ 
+     mutex_lock(&acer_boost_lock);
+     list_del(&h->node);
+     mutex_unlock(&acer_boost_lock);
+ 
+     kfree(h);
+     return 0;
+ }
+ 
+ static long acer_boost_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+ {
+     struct acer_boost_holder *h = file->private_data;
+     struct acer_boost_lease req;
+ 
+     switch (cmd) {
+     case ACER_BOOST_IOC_LEASE:
+         if (copy_from_user(&req, (void __user *)arg, sizeof(req)))
+             return -EFAULT;
+         return acer_boost_lease(h, &req);
+     case ACER_BOOST_IOC_RELEASE:
+         acer_boost_release(h);
+         return 0;
+     default:
+         return -ENOTTY;
+     }
+ }
+ 
+ static const struct file_operations acer_boost_fops = {
+     .owner          = THIS_MODULE,
+     .open           = acer_boost_open,
+     .release        = acer_boost_file_release,
+     .unlocked_ioctl = acer_boost_ioctl,
+     .compat_ioctl   = compat_ptr_ioctl,
+     .llseek         = noop_llseek,
+ };
+ 
+ static struct miscdevice acer_boost_dev = {
+     .minor = MISC_DYNAMIC_MINOR,
+     .name  = "acer-boost",
+     .fops  = &acer_boost_fops,
+     .mode  = 0660,
+ };
+ static bool acer_boost_registered;
+ 
+ static void acer_boost_init(void)
+ {
+     int err;
+ 
+     err = misc_register(&acer_boost_dev);
+     if (err) {
+         pr_warn("Failed to register boost lease device: %d\n", err);
+         return;
+     }
+     acer_boost_registered = true;
+ }
+ 
+ static void acer_boost_exit(void)
+ {
+     if (!acer_boost_registered)
+         return;
+     misc_deregister(&acer_boost_dev);
+     acer_boost_registered = false;
+     cancel_delayed_work_sync(&acer_boost_work);
+ }
+ 
+ /*
+  * Switch series keyboard dock status
+  */
+ static int acer_kbd_dock_state_to_sw_tablet_mode(u8 kbd_dock_state)
+ {
+     switch (kbd_dock_state) {
+     case 0x01: /* Docked, traditional clamshell laptop mode */
+         return 0;
+     case 0x04: /* Stand-alone tablet */
+     case 0x40: /* Docked, tent mode, keyboard not usable */
+         return 1;
+     default:
+         pr_warn("Unknown kbd_dock_state 0x%02x\n", kbd_dock_state);
+     }
+ 
+     return 0;
+ }
+ 
+ static void acer_kbd_dock_get_initial_state(void)
+ {
+     u8 *output, input[8] = { 0x05, 0x00, };
+     struct acpi_buffer input_buf = { sizeof(input), input };
+     struct acpi_buffer output_buf = { ACPI_ALLOCATE_BUFFER, NULL };
+     union acpi_object *obj;
+     acpi_status status;
+     int sw_tablet_mode;
+ 
+     status = wmi_evaluate_method(WMID_GUID3, 0, 0x2, &input_buf, &output_buf);
+     if (ACPI_FAILURE(status)) {
+         pr_err("Error getting keyboard-dock initial status: %s\n",
+                acpi_format_exception(status));
+         return;
+     }
+ 
+     obj = output_buf.pointer;
+     if (!obj || obj->type != ACPI_TYPE_BUFFER || obj->buffer.length != 8) {
+         pr_err("Unexpected output format getting keyboard-dock initial status\n");
+         goto out_free_obj;
+     }
+ 
+     output = obj->buffer.pointer;
+     if (output[0] != 0x00 || (output[3] != 0x05 && output[3] != 0x45)) {
+         pr_err("Unexpected output [0]=0x%02x [3]=0x%02x getting keyboard-dock initial status\n",
+                output[0], output[3]);
+         goto out_free_obj;
+     }
+ 
+     sw_tablet_mode = acer_kbd_dock_state_to_sw_tablet_mode(output[4]);
+     input_report_switch(acer_wmi_input_dev, SW_TABLET_MODE, sw_tablet_mode);
+ 
+ out_free_obj:
+     kfree(obj);
+ }
+ 
+ static void acer_kbd_dock_event(const struct event_return_value *event)
+ {
+     int sw_tablet_mode;
+ 
+     if (!has_cap(ACER_CAP_KBD_DOCK))
+         return;
+ 
+     sw_tablet_mode = acer_kbd_dock_state_to_sw_tablet_mode(event->kbd_dock_state);
+     input_report_switch(acer_wmi_input_dev, SW_TABLET_MODE, sw_tablet_mode);
+     input_sync(acer_wmi_input_dev);
+ }
+ 
+ /*
+  * Rfkill devices
+  */
+ static void acer_rfkill_update(struct work_struct *ignored);
+ static DECLARE_DELAYED_WORK(acer_rfkill_work, acer_rfkill_update);
+ static void acer_rfkill_update(struct work_struct *ignored)
+ {
+     u32 state;
+     acpi_status status;
+ 
+     if (has_cap(ACER_CAP_WIRELESS)) {
+         status = get_u32(&state, ACER_CAP_WIRELESS);
+         if (ACPI_SUCCESS(status)) {
+             if (quirks->wireless == 3)
+                 rfkill_set_hw_state(wireless_rfkill, !state);
+             else
+                 rfkill_set_sw_state(wireless_rfkill, !state);
+         }
+     }
+ 
+     if (has_cap(ACER_CAP_BLUETOOTH)) {
+         status = get_u32(&state, ACER_CAP_BLUETOOTH);
+         if (ACPI_SUCCESS(status))
+             rfkill_set_sw_state(bluetooth_rfkill, !state);
+     }
+ 
+     if (has_cap(ACER_CAP_THREEG) && wmi_has_guid(WMID_GUID3)) {
+         status = get_u32(&state, ACER_WMID3_GDS_THREEG);
+         if (ACPI_SUCCESS(status))
+             rfkill_set_sw_state(threeg_rfkill, !state);
+     }
+ 
+     schedule_delayed_work(&acer_rfkill_work, round_jiffies_relative(HZ));
+ }
+ 
+ static int acer_rfkill_set(void *data, bool blocked)
+ {
+     acpi_status status;
+     u32 cap = (unsigned long)data;
+ 
+     if (rfkill_inited) {
+         status = set_u32(!blocked, cap);
+         if (ACPI_FAILURE(status))
+             return -ENODEV;
+     }
+ 
+     return 0;
+ }
+ 
+ static const struct rfkill_ops acer_rfkill_ops = {
+     .set_block = acer_rfkill_set,
+ };
+ 
+ static struct rfkill *acer_rfkill_register(struct device *dev,
+                        enum rfkill_type type,
+                        char *name, u32 cap)
+ {
+     int err;
+     struct rfkill *rfkill_dev;
+     u32 state;
+     acpi_status status;
+ 
+     rfkill_dev = rfkill_alloc(name, dev, type,
+                   &acer_rfkill_ops,
+                   (void *)(unsigned long)cap);
+     if (!rfkill_dev)
+         return ERR_PTR(-ENOMEM);
+ 
+     status = get_u32(&state, cap);
+ 
+     err = rfkill_register(rfkill_dev);
+     if (err) {
+         rfkill_destroy(rfkill_dev);
+         return ERR_PTR(err);
+     }
+ 
+     if (ACPI_SUCCESS(status))
+         rfkill_set_sw_state(rfkill_dev, !state);
+ 
+     return rfkill_dev;
+ }
+ 
+ static int acer_rfkill_init(struct device *dev)
+ {
+     int err;
+ 
+     if (has_cap(ACER_CAP_WIRELESS)) {
+         wireless_rfkill = acer_rfkill_register(dev, RFKILL_TYPE_WLAN,
+             "acer-wireless", ACER_CAP_WIRELESS);
+         if (IS_ERR(wireless_rfkill)) {
+             err = PTR_ERR(wireless_rfkill);
+             goto error_wireless;
+         }
+     }
+ 
+     if (has_cap(ACER_CAP_BLUETOOTH)) {
+         bluetooth_rfkill = acer_rfkill_register(dev,
+             RFKILL_TYPE_BLUETOOTH, "acer-bluetooth",
+             ACER_CAP_BLUETOOTH);
+         if (IS_ERR(bluetooth_rfkill)) {
+             err = PTR_ERR(bluetooth_rfkill);
+             goto error_bluetooth;
+         }
+     }
+ 
+     if (has_cap(ACER_CAP_THREEG)) {
+         threeg_rfkill = acer_rfkill_register(dev,
+             RFKILL_TYPE_WWAN, "acer-threeg",
+             ACER_CAP_THREEG);
+         if (IS_ERR(threeg_rfkill)) {
+             err = PTR_ERR(threeg_rfkill);
+             goto error_threeg;
+         }
+     }
+ 
+     rfkill_inited = true;
+ 
+     if ((ec_raw_mode || !wmi_has_guid(ACERWMID_EVENT_GUID)) &&
+         has_cap(ACER_CAP_WIRELESS | ACER_CAP_BLUETOOTH | ACER_CAP_THREEG))
+         schedule_delayed_work(&acer_rfkill_work,
+             round_jiffies_relative(HZ));
+ 
+     return 0;
+ 
+ error_threeg:
+     if (has_cap(ACER_CAP_BLUETOOTH)) {
+         rfkill_unregister(bluetooth_rfkill);
+         rfkill_destroy(bluetooth_rfkill);
+     }
+ error_bluetooth:
+     if (has_cap(ACER_CAP_WIRELESS)) {
+         rfkill_unregister(wireless_rfkill);
+         rfkill_destroy(wireless_rfkill);
+     }
+ error_wireless:
+     return err;
+ }
+ 
+ static void acer_rfkill_exit(void)
+ {
+     if ((ec_raw_mode || !wmi_has_guid(ACERWMID_EVENT_GUID)) &&
+         has_cap(ACER_CAP_WIRELESS | ACER_CAP_BLUETOOTH | ACER_CAP_THREEG))
+         cancel_delayed_work_sync(&acer_rfkill_work);
+ 
+     if (has_cap(ACER_CAP_WIRELESS)) {
+         rfkill_unregister(wireless_rfkill);
+         rfkill_destroy(wireless_rfkill);
+     }
+ 
+     if (has_cap(ACER_CAP_BLUETOOTH)) {
+         rfkill_unregister(bluetooth_rfkill);
+         rfkill_destroy(bluetooth_rfkill);
+     }
+ 
+     if (has_cap(ACER_CAP_THREEG)) {
+         rfkill_unregister(threeg_rfkill);
+         rfkill_destroy(threeg_rfkill);
+     }
+ }
+ 
+ static void acer_wmi_notify(union acpi_object *obj, void *context)
+ {
+     struct event_return_value return_value;
+     u16 device_state;
+     const struct key_entry *key;
+     u32 scancode;
+ 
+     if (!obj)
+         return;
+     if (obj->type != ACPI_TYPE_BUFFER) {
+         pr_warn("Unknown response received %d\n", obj->type);
+         return;
+     }
+     if (obj->buffer.length != 8) {
+         pr_warn("Unknown buffer length %d\n", obj->buffer.length);
+         return;
+     }
+ 
+     return_value = *((struct event_return_value *)obj->buffer.pointer);
+ 
+     switch (return_value.function) {
+     case WMID_HOTKEY_EVENT:
+         device_state = return_value.device_state;
+         pr_info("device state: 0x%x\n", device_state);
+ 
+         key = sparse_keymap_entry_from_scancode(acer_wmi_input_dev,
+                             return_value.key_num);
+         if (!key) {
+             pr_warn("Unknown key number - 0x%x\n",
+                 return_value.key_num);
+         } else {
+             scancode = return_value.key_num;
+             switch (key->keycode) {
+             case KEY_WLAN:
+             case KEY_BLUETOOTH:
+                 if (has_cap(ACER_CAP_WIRELESS))
+                     rfkill_set_sw_state(wireless_rfkill,
+                         !(device_state & ACER_WMID3_GDS_WIRELESS));
+                 if (has_cap(ACER_CAP_THREEG))
+                     rfkill_set_sw_state(threeg_rfkill,
+                         !(device_state & ACER_WMID3_GDS_THREEG));
+                 if (has_cap(ACER_CAP_BLUETOOTH))
+                     rfkill_set_sw_state(bluetooth_rfkill,
+                         !(device_state & ACER_WMID3_GDS_BLUETOOTH));
+                 break;
+             case KEY_TOUCHPAD_TOGGLE:
+                 scancode = (device_state & ACER_WMID3_GDS_TOUCHPAD) ?
+                         KEY_TOUCHPAD_ON : KEY_TOUCHPAD_OFF;
+             }
+             sparse_keymap_report_event(acer_wmi_input_dev, scancode, 1, true);
+         }
+         break;
+     case WMID_ACCEL_OR_KBD_DOCK_EVENT:
+         acer_gsensor_event();
+         acer_kbd_dock_event(&return_value);
+         break;
+     case WMID_GAMING_TURBO_KEY_EVENT:
+        pr_info("pressed turbo button - %d\n", return_value.key_num);
+         if (return_value.key_num == 0x4  && !has_cap(ACER_CAP_NITRO_SENSE_V4))
+             acer_toggle_turbo();
+         if ((return_value.key_num == 0x5 || (return_value.key_num == 0x4 && has_cap(ACER_CAP_NITRO_SENSE_V4))) && has_cap(ACER_CAP_PLATFORM_PROFILE))
+             acer_thermal_profile_change();
+         break;
+     case WMID_AC_EVENT:
+         if (return_value.key_num <= 1) {
+             WRITE_ONCE(acer_on_ac, return_value.key_num);
+             acer_stats_set_power(return_value.key_num);
+         }
+         if(has_cap(ACER_CAP_PREDATOR_SENSE) || has_cap(ACER_CAP_NITRO_SENSE_V4)){
+             /* The probe time restore would otherwise race the switch */
+             acer_state_restore_wait();
+             mutex_lock(&acer_state_apply_lock);
+             if(return_value.key_num == 0){
+                 /* store the current state when it is connected to AC*/
+                 acer_predator_state_update(1);
+                 /* restore to the state when it was disconnected from AC*/
+                 acer_predator_state_restore(0);
+             } else if (return_value.key_num == 1){
+                 /* store the current state when it is disconnected from AC*/
+                 acer_predator_state_update(0);
+                 /* restore to the state when it was connected to AC*/
+                 acer_predator_state_restore(1);
+             } else {
+                 pr_info("Unknown key number - %d\n", return_value.key_num);
+             }
+             mutex_unlock(&acer_state_apply_lock);
+         }
+         break;
+     case WMID_BATTERY_BOOST_EVENT:
+         break;
+     case WMID_CALIBRATION_EVENT:
+         if(has_cap(ACER_CAP_PREDATOR_SENSE) || has_cap(ACER_CAP_NITRO_SENSE) || has_cap(ACER_CAP_NITRO_SENSE_V4)){
+             if (battery_health_set(CALIBRATION_MODE,return_value.key_num) != AE_OK){
+                 pr_err("Error changing calibration state\n");
+             }
+         }
+         break;
+     default:
+         pr_warn("Unknown function number - %d - %d\n",
+             return_value.function, return_value.key_num);
+         break;
+     }
+ }
+ 
+ static acpi_status __init
+ wmid3_set_function_mode(struct func_input_params *params,
+             struct func_return_value *return_value)
+ {
+     acpi_status status;
+     union acpi_object *obj;
+ 
+     struct acpi_buffer input = { sizeof(struct func_input_params), params };
+     struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
+ 
+     status = wmi_evaluate_method(WMID_GUID3, 0, 0x1, &input, &output);
+     if (ACPI_FAILURE(status))
+         return status;
+ 
+     obj = output.pointer;
+ 
+     if (!obj)
+         return AE_ERROR;
+     else if (obj->type != ACPI_TYPE_BUFFER) {
+         kfree(obj);
+         return AE_ERROR;
+     }
+     if (obj->buffer.length != 4) {
+         pr_warn("Unknown buffer length %d\n", obj->buffer.length);
+         kfree(obj);
+         return AE_ERROR;
+     }
+ 
+     *return_value = *((struct func_return_value *)obj->buffer.pointer);
+     kfree(obj);
+ 
+     return status;
+ }
+ 
+ static int __init acer_wmi_enable_ec_raw(void)
+ {
+     struct func_return_value return_value;
+     acpi_status status;
+     struct func_input_params params = {
+         .function_num = 0x1,
+         .commun_devices = 0xFFFF,
+         .devices = 0xFFFF,
+         .app_status = 0x00,		/* Launch Manager Deactive */
+         .app_mask = 0x01,
+     };
+ 
+     status = wmid3_set_function_mode(&params, &return_value);
+ 
+     if (return_value.error_code || return_value.ec_return_value)
+         pr_warn("Enabling EC raw mode failed: 0x%x - 0x%x\n",
+             return_value.error_code,
+             return_value.ec_return_value);
+     else
+         pr_info("Enabled EC raw mode\n");
+ 
+     return status;
+ }
+ 
+ static int __init acer_wmi_enable_lm(void)
+ {
+     struct func_return_value return_value;
+     acpi_status status;
+     struct func_input_params params = {
+         .function_num = 0x1,
+         .commun_devices = 0xFFFF,
+         .devices = 0xFFFF,
+         .app_status = 0x01,            /* Launch Manager Active */
+         .app_mask = 0x01,
+     };
+ 
+     status = wmid3_set_function_mode(&params, &return_value);
+ 
+     if (return_value.error_code || return_value.ec_return_value)
+         pr_warn("Enabling Launch Manager failed: 0x%x - 0x%x\n",
+             return_value.error_code,
+             return_value.ec_return_value);
+ 
+     return status;
+ }
+ 
+ static int __init acer_wmi_enable_rf_button(void)
+ {
+     struct func_return_value return_value;
+     acpi_status status;
+     struct func_input_params params = {
+         .function_num = 0x1,
+         .commun_devices = 0xFFFF,
+         .devices = 0xFFFF,
+         .app_status = 0x10,            /* RF Button Active */
+         .app_mask = 0x10,
+     };
+ 
+     status = wmid3_set_function_mode(&params, &return_value);
+ 
+     if (return_value.error_code || return_value.ec_return_value)
+         pr_warn("Enabling RF Button failed: 0x%x - 0x%x\n",
+             return_value.error_code,
+             return_value.ec_return_value);
+ 
+     return status;
+ }
+ 
+ static int __init acer_wmi_accel_setup(void)
+ {
+     struct acpi_device *adev;
+     int err;
+ 
+     adev = acpi_dev_get_first_match_dev("BST0001", NULL, -1);
+     if (!adev)
+         return -ENODEV;
+ 
+     gsensor_handle = acpi_device_handle(adev);
+     acpi_dev_put(adev);
+ 
+     acer_wmi_accel_dev = input_allocate_device();
+     if (!acer_wmi_accel_dev)
+         return -ENOMEM;
+ 
+     acer_wmi_accel_dev->open = acer_gsensor_open;
+ 
+     acer_wmi_accel_dev->name = "Acer BMA150 accelerometer";
+     acer_wmi_accel_dev->phys = "wmi/input1";
+     acer_wmi_accel_dev->id.bustype = BUS_HOST;
+     acer_wmi_accel_dev->evbit[0] = BIT_MASK(EV_ABS);
+     input_set_abs_params(acer_wmi_accel_dev, ABS_X, -16384, 16384, 0, 0);
+     input_set_abs_params(acer_wmi_accel_dev, ABS_Y, -16384, 16384, 0, 0);
+     input_set_abs_params(acer_wmi_accel_dev, ABS_Z, -16384, 16384, 0, 0);
+ 
+     err = input_register_device(acer_wmi_accel_dev);
+     if (err)
+         goto err_free_dev;
+ 
+     return 0;
+ 
+ err_free_dev:
+     input_free_device(acer_wmi_accel_dev);
+     return err;
+ }
+ 
+ static int __init acer_wmi_input_setup(void)
+ {
+     acpi_status status;
+     int err;
+ 
+     acer_wmi_input_dev = input_allocate_device();
+     if (!acer_wmi_input_dev)
+         return -ENOMEM;
+ 
+     acer_wmi_input_dev->name = "Acer WMI hotkeys";
+     acer_wmi_input_dev->phys = "wmi/input0";
+     acer_wmi_input_dev->id.bustype = BUS_HOST;
+ 
+     err = sparse_keymap_setup(acer_wmi_input_dev, acer_wmi_keymap, NULL);
+     if (err)
+         goto err_free_dev;
+ 
+     if (has_cap(ACER_CAP_KBD_DOCK))
+         input_set_capability(acer_wmi_input_dev, EV_SW, SW_TABLET_MODE);
+ 
+     status = wmi_install_notify_handler(ACERWMID_EVENT_GUID,
+                         acer_wmi_notify, NULL);
+     if (ACPI_FAILURE(status)) {
+         err = -EIO;
+         goto err_free_dev;
+     }
+ 
+     if (has_cap(ACER_CAP_KBD_DOCK))
+         acer_kbd_dock_get_initial_state();
+ 
+     err = input_register_device(acer_wmi_input_dev);
+     if (err)
+         goto err_uninstall_notifier;
+ 
+     return 0;
+ 
+ err_uninstall_notifier:
+     wmi_remove_notify_handler(ACERWMID_EVENT_GUID);
+ err_free_dev:
+     input_free_device(acer_wmi_input_dev);
+     return err;
+ }
+ 
+ static void acer_wmi_input_destroy(void)
+ {
+     wmi_remove_notify_handler(ACERWMID_EVENT_GUID);
+     input_unregister_device(acer_wmi_input_dev);
+ }
+ 
+ /*
+  * debugfs functions
+  */
+ static u32 get_wmid_devices(void)
+ {
+     struct acpi_buffer out = {ACPI_ALLOCATE_BUFFER, NULL};
+     union acpi_object *obj;
+     acpi_status status;
+     u32 devices = 0;
+ 
+     status = wmi_query_block(WMID_GUID2, 0, &out);
+     if (ACPI_FAILURE(status))
+         return 0;
+ 
+     obj = (union acpi_object *) out.pointer;
+     if (obj) {
+         if (obj->type == ACPI_TYPE_BUFFER &&
+             (obj->buffer.length == sizeof(u32) ||
+             obj->buffer.length == sizeof(u64))) {
+             devices = *((u32 *) obj->buffer.pointer);
+         } else if (obj->type == ACPI_TYPE_INTEGER) {
+             devices = (u32) obj->integer.value;
+         }
+     }
+ 
+     kfree(out.pointer);
+     return devices;
+ }
+ 
+ static int acer_wmi_hwmon_init(void);
+ 
+ 
+ /*
+  * USB Charging
+  */
+ /* Last known usb charging threshold, -1 if unknown */
+ static int usb_charging_state = -1;
+ 
+ static acpi_status acer_usb_charging_get(int *val){
+     acpi_status status;
+     u64 result;
+     status = WMI_apgeaction_execute_u64(ACER_WMID_GET_FUNCTION,0x4,&result);
+     if(ACPI_FAILURE(status)){
+         pr_err("Error getting usb charging status: %s\n",acpi_format_exception(status));
+         return status;
+     }
+     *val = result == 663296 ? 0 : result == 659200 ? 10 : result == 1314560 ? 20 : result == 1969920 ? 30 : -1; //-1 means unknown value
+     usb_charging_state = *val;
+     return AE_OK;
+ }
+ 
+ static acpi_status acer_usb_charging_set(int val){
+     acpi_status status;
+     u64 result;
+     pr_info("usb charging set value: %d\n",val);
+     status = WMI_apgeaction_execute_u64(ACER_WMID_SET_FUNCTION,val == 0 ? 663300 : val == 10 ? 659204 : val == 20 ? 1314564 : val == 30 ? 1969924 : 663300, &result); //if unkown value then turn it off.
+     if(ACPI_FAILURE(status)){
+         pr_err("Error setting usb charging status: %s\n",acpi_format_exception(status));
+         usb_charging_state = -1;
+         return status;
+     }
+     pr_info("usb charging set status: %llu\n",result);
+     usb_charging_state = val;
+     return AE_OK;
+ }
+ 
+ static ssize_t predator_usb_charging_show(struct device *dev, struct device_attribute *attr,char *buf){
+     acpi_status status;
+     int val;
+     /* The get refreshes the shadow the transactions snapshot */
+     mutex_lock(&acer_gaming_lock);
+     status = acer_usb_charging_get(&val);
+     mutex_unlock(&acer_gaming_lock);
+     if (ACPI_FAILURE(status))
+         return -ENODEV;
+     return sprintf(buf, "%d\n", val);
+ }
+ 
+ static ssize_t predator_usb_charging_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+     struct acer_gaming_txn txn = ACER_GAMING_TXN_USER("usb charging");
+     u8 val;
+       if (sscanf(buf, "%hhd", &val) != 1)
+         return -EINVAL;
+       if ((val != 0) && (val != 10) && (val != 20) && (val != 30))
+         return -EINVAL;
+     acer_state_restore_wait();
+     acer_txn_add(&txn, ACER_TXN_USB_CHARGING, 0, val, 0);
+     if (acer_txn_commit(&txn))
+         return -ENODEV;
+     return count;
+ }
+ 
+ /*
+  * Battery Limit (80%)
+  * Battery Calibration
+  */
+ struct get_battery_health_control_status_input {
+     u8 uBatteryNo;
+     u8 uFunctionQuery;
+     u8 uReserved[2];
+ } __packed;
+ 
+ struct get_battery_health_control_status_output {
+     u8 uFunctionList;
+     u8 uReturn[2];
+     u8 uFunctionStatus[5];
+ } __packed;
+ 
+ struct set_battery_health_control_input {
+     u8 uBatteryNo;
+     u8 uFunctionMask;
+     u8 uFunctionStatus;
+     u8 uReservedIn[5];
+ } __packed;
+ 
+ struct set_battery_health_control_output {
+     u8 uReturn;
+     u8 uReservedOut;
+ } __packed;
+ 
+ 
+ static acpi_status battery_health_query(int mode, int *enabled){
+     pr_info("battery health query: %d\n",mode);
+     acpi_status status;
+     union acpi_object *obj;
+     struct get_battery_health_control_status_input params = {
+         .uBatteryNo = 0x1,
+         .uFunctionQuery = 0x1,
+         .uReserved = { 0x0, 0x0 }
+     };
+     struct get_battery_health_control_status_output ret;
+ 
+     struct acpi_buffer input = {
+         sizeof(struct get_battery_health_control_status_input), &params
+     };
+ 
+     struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
+ 
+     status = wmi_evaluate_method(WMID_GUID5, 0, ACER_WMID_GET_BATTERY_HEALTH_CONTROL_STATUS_METHODID, &input, &output);
+     if (ACPI_FAILURE(status))
+         return status;
+     
+     obj = output.pointer;
+ 
+       if (!obj || obj->type != ACPI_TYPE_BUFFER || obj->buffer.length != 8) {
+         pr_err("Unexpected output format getting battery health status, buffer "
+                "length:%d\n",
+                obj->buffer.length);
+         goto failed;
+       }
+     
+       ret = *((struct get_battery_health_control_status_output *)obj->buffer.pointer);
+     
+     if(mode == HEALTH_MODE){
+         *enabled = ret.uFunctionStatus[0];
+     } else if(mode == CALIBRATION_MODE){
+         *enabled = ret.uFunctionStatus[1];
+     } else {
+         goto failed;
+     }
+ 
+     kfree(obj);
+     return AE_OK;
+ 
+     failed:
+           kfree(obj);
+           return AE_ERROR;
+ }
+ 
+ static acpi_status battery_health_set(u8 function, u8 function_status){
+ 
+     pr_info("battery_health_set: %d | %d\n",function,function_status);
+     
+     acpi_status status;
+     union acpi_object *obj;
+     struct set_battery_health_control_input params = {
+         .uBatteryNo = 0x1,
+         .uFunctionMask = function,
+         .uFunctionStatus = function_status,
+         .uReservedIn = { 0x0, 0x0, 0x0, 0x0, 0x0 }
+     };
+     struct set_battery_health_control_output  ret;
+ 
+     struct acpi_buffer input = {
+         sizeof(struct set_battery_health_control_input), &params
+     };
+ 
+     struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
+ 
+     status = wmi_evaluate_method(WMID_GUID5, 0, ACER_WMID_SET_BATTERY_HEALTH_CONTROL_METHODID, &input, &output);
+     if (ACPI_FAILURE(status))
+         return status;
+     
+     obj = output.pointer;
+ 
+       if (!obj || obj->type != ACPI_TYPE_BUFFER || obj->buffer.length != 4) {
+         pr_err("Unexpected output format getting battery health status, buffer "
+                "length:%d\n",
+                obj->buffer.length);
+         goto failed;
+       }
+     
+       ret = *((struct set_battery_health_control_output  *)obj->buffer.pointer);
+     
+     if(ret.uReturn != 0 && ret.uReservedOut != 0){
+         pr_err("Failed to set battery health status\n");
+         goto failed;
+     }
+ 
+     kfree(obj);
+     return AE_OK;
+ 
+     failed:
+           kfree(obj);
+           return AE_ERROR;
+ }
+ 
+ 
+ static ssize_t predator_battery_limit_show(struct device *dev,
+                                            struct device_attribute *attr,
+                                            char *buf) {
+ 
+     int enabled;
+     acpi_status status = battery_health_query(HEALTH_MODE, &enabled);
+ 
+     if (ACPI_FAILURE(status))
+         return -ENODEV;
+ 
+     return sprintf(buf, "%d\n", enabled);
+ }
+ 
+ static ssize_t predator_battery_limit_store(struct device *dev,
+                                             struct device_attribute *attr,
+                                             const char *buf, size_t count) {
+     u8 val;
+       if (sscanf(buf, "%hhd", &val) != 1)
+         return -EINVAL;
+ 
+       if ((val != 0) && (val != 1))
+         return -EINVAL;
+       
+     if (battery_health_set(HEALTH_MODE,val) != AE_OK)
+         return -ENODEV;
+       
+     return count;
+ }
+ 
+ static ssize_t predator_battery_calibration_show(struct device *dev,
+                                            struct device_attribute *attr,
+                                            char *buf) {
+ 
+     int enabled;
+     acpi_status status = battery_health_query(CALIBRATION_MODE, &enabled);
+ 
+     if (ACPI_FAILURE(status))
+         return -ENODEV;
+ 
+     return sprintf(buf, "%d\n", enabled);
+ }
+ 
+ static ssize_t preadtor_battery_calibration_store(struct device *dev,
+                                             struct device_attribute *attr,
+                                             const char *buf, size_t count) {
+     u8 val;
+       if (sscanf(buf, "%hhd", &val) != 1)
+         return -EINVAL;
+       
+     if ((val != 0) && (val != 1))
+         return -EINVAL;
+       
+     if (battery_health_set(CALIBRATION_MODE,val) != AE_OK)
+         return -ENODEV;
+       
+     return count;
+ }
+ 
+ 
+ /*
+  * FAN CONTROLS
+  */
+ 
+ static u64 fan_val_calc(int percentage, int fan_index) {
+     return (((percentage * 25600) / 100) & 0xFF00) + fan_index;
+ }
+ static acpi_status acer_set_fan_speed(int t_cpu_fan_speed, int t_gpu_fan_speed){
+     
+     acpi_status status;
+ 
+     if (t_cpu_fan_speed == 100 && t_gpu_fan_speed == 100) {
+         pr_info("MAX FAN MODE!\n");
+         status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0x820009, NULL);
+         if(ACPI_FAILURE(status)){
+             pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
+             return AE_ERROR;
+         }
+     } else if (t_cpu_fan_speed == 0 && t_gpu_fan_speed == 0) {
+         pr_info("AUTO FAN MODE!\n");
+         status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0x410009, NULL);
+         if(ACPI_FAILURE(status)){
+             pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
+             return AE_ERROR;
+         }
+     } else if (t_cpu_fan_speed <= 100 && t_gpu_fan_speed <= 100) {
+         if (t_cpu_fan_speed == 0) {
+             pr_info("CUSTOM FAN MODE (GPU)\n");
+             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0x10001, NULL);
+             if(ACPI_FAILURE(status)){
+                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
+                 return AE_ERROR;
+             }
+             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0xC00008, NULL);
+             if(ACPI_FAILURE(status)){
+                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
+                 return AE_ERROR;
+             }
+             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_SPEED_METHODID, fan_val_calc(t_gpu_fan_speed,4), NULL);
+             if(ACPI_FAILURE(status)){
+                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
+                 return AE_ERROR;
+             }
+         } else if (t_gpu_fan_speed == 0) {
+             pr_info("CUSTOM FAN MODE (CPU)\n");
+             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0x400008, NULL);
+             if(ACPI_FAILURE(status)){
+                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
+                 return AE_ERROR;
+             }
+             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0x30001, NULL);
+             if(ACPI_FAILURE(status)){
+                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
+                 return AE_ERROR;
+             }
+             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_SPEED_METHODID, fan_val_calc(t_cpu_fan_speed,1), NULL);
+             if(ACPI_FAILURE(status)){
+                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
+                 return AE_ERROR;
+             }
+         } else {
+             pr_info("CUSTOM FAN MODE (MIXED)!\n");
+             //set gaming behvaiour mode to custom
+             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0xC30009, NULL);
+             if(ACPI_FAILURE(status)){
+                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
+                 return AE_ERROR;
+             }
+             //set cpu fan speed
+             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_SPEED_METHODID, fan_val_calc(t_cpu_fan_speed,1), NULL);
+             if(ACPI_FAILURE(status)){
+                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
+                 return AE_ERROR;
+             }
+             //set gpu fan speed
+             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_SPEED_METHODID, fan_val_calc(t_gpu_fan_speed,4), NULL);
+             if(ACPI_FAILURE(status)){
+                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
+                 return AE_ERROR;
+             }
+         }
+     } else {
+         return AE_ERROR;
+     }
+ 
+     cpu_fan_speed = t_cpu_fan_speed;
+     gpu_fan_speed = t_gpu_fan_speed;
+     pr_info("Fan speeds updated: CPU=%d, GPU=%d\n", cpu_fan_speed, gpu_fan_speed);
+ 
+     return AE_OK;	
+ }
+ 
+ static ssize_t predator_fan_speed_show(struct device *dev,
+                                            struct device_attribute *attr,
+                                            char *buf) {
+   return sprintf(buf, "%d,%d\n", cpu_fan_speed, gpu_fan_speed);                           
+ }
+ 
+ 
+ static ssize_t predator_fan_speed_store(struct device *dev,
+                                             struct device_attribute *attr,
+                                             const char *buf, size_t count) {
+     struct acer_gaming_txn txn = ACER_GAMING_TXN_USER("fan speed");
+     int t_cpu_fan_speed, t_gpu_fan_speed;
+     
+     char input[9];
+     char *token;
+     char* input_ptr = input;
+     size_t len = min(count, sizeof(input) - 1);
+     strncpy(input, buf, len);
+ 
+     if(input[len-1] == '\n'){
+         input[len-1] = '\0';
+     } else {
+         input[len] = '\0';
+     }
+ 
+ 
+     token = strsep(&input_ptr, ",");
+     if (!token || kstrtoint(token, 10, &t_cpu_fan_speed) || t_cpu_fan_speed < 0 || t_cpu_fan_speed > 100) {
+         pr_err("Invalid CPU speed value.\n");
+         return -EINVAL;
+     }
+ 
+     token = strsep(&input_ptr, ",");
+     if (!token || kstrtoint(token, 10, &t_gpu_fan_speed) || t_gpu_fan_speed < 0 || t_gpu_fan_speed > 100) {
+         pr_err("Invalid GPU speed value.\n");
+         return -EINVAL;
+     }
+ 
+     acer_state_restore_wait();
+     acer_txn_add_fan_speed(&txn, t_cpu_fan_speed, t_gpu_fan_speed);
+     if (acer_txn_commit(&txn))
+         return -ENODEV;
+ 
+     return count;
+ }
+ /*
+  * Persisted state container
+  *
+  * The persisted state is a sequence of records, each starting with a header
+  * carrying a magic, the format version, the payload type and length, and a
+  * crc32 of the payload. It is read and written by userspace through the
+  * binary "state" attribute. Files written before the header existed
+  * (version 0) are the bare struct and are still accepted when written on
+  * their own. Anything that does not validate is rejected before any
+  * firmware call.
+  */
+ #define ACER_STATE_MAGIC        0x534c5741  /* "AWLS" */
+ #define ACER_STATE_VERSION      1
+ #define ACER_STATE_MAX_PAYLOAD  128
+ 
+ enum acer_state_type {
+     ACER_STATE_POWER    = 1,
+     ACER_STATE_KB       = 2,
+ };
+ 
+ struct acer_state_header {
+     __le32 magic;
+     __le16 version;
+     __le16 type;
+     __le32 length;      /* payload bytes following the header */
+     __le32 crc;         /* crc32 of the payload */
+ } __packed;
+ 
+ static u32 acer_state_crc(const void *payload, size_t len)
+ {
+     return ~crc32_le(~0, payload, len);
+ }
+ 
+ /* Check the record at buf, returns its total size or a negative errno */
+ static ssize_t acer_state_check(const void *buf, size_t size)
+ {
+     const struct acer_state_header *hdr = buf;
+     size_t plen;
+ 
+     if (size < sizeof(*hdr) || le32_to_cpu(hdr->magic) != ACER_STATE_MAGIC)
+         return -EBADMSG;
+     plen = le32_to_cpu(hdr->length);
+     if (plen > size - sizeof(*hdr) || le32_to_cpu(hdr->crc) != acer_state_crc(hdr + 1, plen))
+         return -EBADMSG;
+ 
+     return sizeof(*hdr) + plen;
+ }
+ 
+ static int acer_state_decode(const struct acer_state_header *hdr, void *payload, size_t len)
+ {
+     /* Migrate older layouts forward here when the payload structs change */
+     switch (le16_to_cpu(hdr->version)) {
+     case 1:
+         if (le32_to_cpu(hdr->length) != len)
+             return -EBADMSG;
+         memcpy(payload, hdr + 1, len);
+         return 0;
+     default:
+         return -EPROTONOSUPPORT;
+     }
+ }
+ 
+ static size_t acer_state_pack(enum acer_state_type type, const void *payload, size_t len,
+                               void *buf)
+ {
+     struct acer_state_header *hdr = buf;
+ 
+     hdr->magic = cpu_to_le32(ACER_STATE_MAGIC);
+     hdr->version = cpu_to_le16(ACER_STATE_VERSION);
+     hdr->type = cpu_to_le16(type);
+     hdr->length = cpu_to_le32(len);
+     hdr->crc = cpu_to_le32(acer_state_crc(payload, len));
+     memcpy(hdr + 1, payload, len);
+ 
+     return sizeof(*hdr) + len;
+ }
+ 
+ /*
+  * persistent predator states.
+  */
+ struct acer_predator_state {
+     int cpu_fan_speed;
+     int gpu_fan_speed;
+     int thermal_profile;
+ };
+ 
+ struct power_states {
+     struct acer_predator_state battery_state;
+     struct acer_predator_state ac_state;
+ } __attribute__((packed));
+ 
+ static struct power_states current_states = {
+     .battery_state = {0, 0, ACER_PREDATOR_V4_THERMAL_PROFILE_ECO},
+     .ac_state = {0, 0, ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED}
+ };
+ 
+ static int acer_predator_state_update(int value){
+     int cpu_fan = cpu_fan_speed, gpu_fan = gpu_fan_speed;
+     u8 current_tp;
+     int tp, err;
+     err = acer_thermal_profile_read(&current_tp);
+     if (err)
+         return err;
+     switch (current_tp) {
+         case ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO:
+             tp = ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO;
+             break;
+         case ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE:
+             tp = ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE;
+             break;
+         case ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED:
+             tp = ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED;
+             break;
+         case ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET:
+             tp = ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET;
+             break;
+         case ACER_PREDATOR_V4_THERMAL_PROFILE_ECO:
+             tp = ACER_PREDATOR_V4_THERMAL_PROFILE_ECO;
+             break;
+         default:
+             return -1;
+     }
+     /* A boost lease is temporary, save what it goes back to */
+     acer_boost_saved_state(&tp, &cpu_fan, &gpu_fan);
+     /* When AC is connected */
+     if(value == 1){
+         current_states.ac_state.thermal_profile = tp;
+         current_states.ac_state.cpu_fan_speed = cpu_fan;
+         current_states.ac_state.gpu_fan_speed = gpu_fan;
+     /* When AC isn't connected */
+     } else if(value == 0){
+         current_states.battery_state.thermal_profile = tp;
+         current_states.battery_state.cpu_fan_speed = cpu_fan;
+         current_states.battery_state.gpu_fan_speed = gpu_fan;
+     } else {
+         pr_err("invalid value received: %d\n", value);
+         return -1;
+     }
+     return 0;
+ }
+ 
+ static acpi_status acer_predator_state_restore(int value){
+     struct acer_gaming_txn txn = ACER_GAMING_TXN("power state restore");
+     struct acer_predator_state *state = value == 0 ? &current_states.battery_state : &current_states.ac_state;
+ 
+     acer_txn_add_profile(&txn, state->thermal_profile);
+     acer_txn_add_fan_speed(&txn, state->cpu_fan_speed, state->gpu_fan_speed);
+ 
+     if (acer_txn_commit(&txn))
+         return AE_ERROR;
+ 
+     return AE_OK;
+ }
+ 
+ static bool acer_predator_state_valid(const struct acer_predator_state *state)
+ {
+     enum platform_profile_option profile;
+ 
+     return state->cpu_fan_speed >= 0 && state->cpu_fan_speed <= 100 &&
+            state->gpu_fan_speed >= 0 && state->gpu_fan_speed <= 100 &&
+            state->thermal_profile >= 0 && state->thermal_profile <= U8_MAX &&
+            !acer_predator_v4_tp_to_profile(state->thermal_profile, &profile);
+ }
+ 
+ /* Apply the saved state for the current power source */
+ static int acer_predator_state_init(void)
+ {
+     u64 on_AC;
+     acpi_status status;
+ 
+     status = WMI_gaming_execute_u64(
+         ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
+         ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS, &on_AC);
+ 
+     if (ACPI_FAILURE(status)) {
+         pr_err("Failed to query power source state\n");
+         return -1;
+     }
+     WRITE_ONCE(acer_on_ac, on_AC ? 1 : 0);
+ 
+     /* Restore state based on power source (0 for battery, 1 for AC) */
+     status = acer_predator_state_restore(on_AC == 0 ? 0 : 1);
+     if (ACPI_FAILURE(status)) {
+         pr_err("Failed to restore thermal state\n");
+         return -1;
+     }
+ 
+     pr_info("Thermal states restored successfully\n");
+     return 0;
+ }
+ 
+ /*
+  * The restore at probe runs from a work item so module load does not wait on
+  * the firmware. Every other gaming write path (sysfs, the mode and turbo
+  * keys, AC events, boost leases, presets, state blobs and resume) waits for
+  * it first, so none of them can be overwritten by the restore.
+  */
+ static ktime_t acer_restore_queued;
+ static u64 acer_restore_us;
+ 
+ static void acer_state_restore_fn(struct work_struct *work)
+ {
+     ktime_t start = ktime_get();
+     int err;
+ 
+     err = acer_predator_state_init();
+     if (quirks->four_zone_kb)
+         kb_leds_seed();
+     acer_restore_us = ktime_us_delta(ktime_get(), start);
+     pr_info("State restore %s after %llu us (%lld us after probe)\n",
+             err ? "failed" : "completed", acer_restore_us,
+             ktime_us_delta(ktime_get(), acer_restore_queued));
+ }
+ static DECLARE_WORK(acer_restore_work, acer_state_restore_fn);
+ 
+ static void acer_state_restore_start(void)
+ {
+     acer_restore_queued = ktime_get();
+     schedule_work(&acer_restore_work);
+ }
+ 
+ static void acer_state_restore_wait(void)
+ {
+     flush_work(&acer_restore_work);
+ }
+ 
+ /*
+  * Dirty tracking. Every change a user makes to a persisted setting marks the
+  * state dirty, transient writes (boost leases, effect frames, restores) do
+  * not, so only the user facing setters call this. The first change arms a
+  * timer and when it fires a single change uevent asks userspace (the udev
+  * rule shipped with the driver) to save the state blob. Changes in between
+  * are batched, so there is at most one save per interval.
+  */
+ static unsigned int state_writeback_interval = 30;
+ module_param(state_writeback_interval, uint, 0644);
+ MODULE_PARM_DESC(state_writeback_interval, "Seconds between state save requests to userspace after a change (0 to disable)");
+ 
+ static struct device *acer_state_dev;
+ static bool acer_state_dirty;
+ 
+ static void acer_state_writeback_fn(struct work_struct *work)
+ {
+     char *envp[] = { "LINUWU_STATE=dirty", NULL };
+ 
+     if (!xchg(&acer_state_dirty, false) || !acer_state_dev)
+         return;
+ 
+     kobject_uevent_env(&acer_state_dev->kobj, KOBJ_CHANGE, envp);
+ }
+ static DECLARE_DELAYED_WORK(acer_state_writeback_work, acer_state_writeback_fn);
+ 
+ static void acer_state_mark_dirty(void)
+ {
+     unsigned int interval = READ_ONCE(state_writeback_interval);
+ 
+     if (!interval || !READ_ONCE(acer_state_dev))
+         return;
+ 
+     WRITE_ONCE(acer_state_dirty, true);
+     /* Does nothing if already pending, that is what batches the changes */
+     schedule_delayed_work(&acer_state_writeback_work, interval * HZ);
+ }
+ 
+ /*
+  * On the way down the state has been saved from the shadow copies by
+  * userspace already (reading "state" does not touch the firmware once the
+  * driver has seen the values). Stop background work so nothing else talks
+  * to the firmware or asks for another save while the machine goes off.
+  */
+ static int acer_reboot_notify(struct notifier_block *nb, unsigned long action, void *data)
+ {
+     WRITE_ONCE(acer_state_dev, NULL);
+     cancel_delayed_work_sync(&acer_state_writeback_work);
+     cancel_delayed_work_sync(&acer_profile_resync_work);
+     cancel_delayed_work_sync(&acer_profile_register_work);
+     cancel_delayed_work_sync(&acer_boost_work);
+     cancel_work_sync(&acer_restore_work);
+     acer_wmi_hwmon_sample_stop();
+     cancel_delayed_work_sync(&acer_stats_sample_work);
+ 
+     return NOTIFY_DONE;
+ }
+ 
+ static struct notifier_block acer_reboot_nb = {
+     .notifier_call = acer_reboot_notify,
+ };
+ 
+ /*
+  *LCD OVERRIDE CONTROLS
+  */
+ /* Last known lcd override state, -1 if unknown */
+ static int lcd_override_state = -1;
+ 
+ static acpi_status acer_lcd_override_get(int *val){
+     acpi_status status;
+     u64 result;
+     status = WMI_gaming_execute_u64(ACER_WMID_GET_GAMING_PROFILE_METHODID,0x00,&result);
+     if(ACPI_FAILURE(status)){
+         pr_err("Error getting lcd override status: %s\n",acpi_format_exception(status));
+         return status;
+     }
+     *val = result == 0x1000001000000 ? 1 : result == 0x1000000 ? 0 : -1;
+     lcd_override_state = *val;
+     return AE_OK;
+ }
+ 
+ static acpi_status acer_lcd_override_set(int val){
+     acpi_status status;
+     u64 result;
+     pr_info("lcd_override set value: %d\n",val);
+     status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_PROFILE_METHODID,val == 1 ? 0x1000000000010 : 0x10, &result);
+     if(ACPI_FAILURE(status)){
+         pr_err("Error setting lcd override status: %s\n",acpi_format_exception(status));
+         lcd_override_state = -1;
+         return status;
+     }
+     pr_info("lcd override set status: %llu\n",result);
+     lcd_override_state = val;
+     return AE_OK;
+ }
+ 
+ static ssize_t predator_lcd_override_show(struct device *dev, struct device_attribute *attr,char *buf){
+     acpi_status status;
+     int val;
+     /* The get refreshes the shadow the transactions snapshot */
+     mutex_lock(&acer_gaming_lock);
+     status = acer_lcd_override_get(&val);
+     mutex_unlock(&acer_gaming_lock);
+     if (ACPI_FAILURE(status))
+         return -ENODEV;
+     return sprintf(buf, "%d\n", val);
+ }
+ 
+ static ssize_t predator_lcd_override_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+     struct acer_gaming_txn txn = ACER_GAMING_TXN_USER("lcd override");
+     u8 val;
+       if (sscanf(buf, "%hhd", &val) != 1)
+         return -EINVAL;
+       if ((val != 0) && (val != 1))
+         return -EINVAL;
+     acer_state_restore_wait();
+     acer_txn_add(&txn, ACER_TXN_LCD_OVERRIDE, 0, val, 0);
+     if (acer_txn_commit(&txn))
+         return -ENODEV;
+     return count;
+ }
+ 
+ /*
+  * BACKLIGHT 30 SEC TIMEOUT
+  */
+ 
+ static ssize_t predator_backlight_timeout_show(struct device *dev, struct device_attribute *attr,char *buf){
+     acpi_status status;
+     u64 result;
+     status = WMI_apgeaction_execute_u64(ACER_WMID_GET_FUNCTION,0x88401,&result);
+     if(ACPI_FAILURE(status)){
+         pr_err("Error getting backlight_timeout status: %s\n",acpi_format_exception(status));
+         return -ENODEV;
+     }
+     pr_info("backlight_timeout get status: %llu\n",result);
+     return sprintf(buf, "%d\n", result == 0x1E0000080000 ? 1 : result == 0x80000 ? 0 : -1);
+ }
+ 
+ static ssize_t predator_backlight_timeout_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+     acpi_status status;
+     u64 result;
+     u8 val;
+       if (sscanf(buf, "%hhd", &val) != 1)
+         return -EINVAL;
+       if ((val != 0) && (val != 1))
+         return -EINVAL;
+     pr_info("bascklight_timeout set value: %d\n",val);
+     status = WMI_apgeaction_execute_u64(ACER_WMID_SET_FUNCTION,val == 1 ? 0x1E0000088402 : 0x88402, &result);
+     if(ACPI_FAILURE(status)){
+         pr_err("Error setting backlight_timeout status: %s\n",acpi_format_exception(status));
+         return -ENODEV;
+     }
+     pr_info("backlight_timeout set status: %llu\n",result);
+     return count;
+ }
+ 
+ /*
+  * System Boot Animation & Sound 
+  */
+ static ssize_t predator_boot_animation_sound_show(struct device *dev, struct device_attribute *attr,char *buf){
+     acpi_status status;
+     u64 result;
+     status = WMI_gaming_execute_u64(ACER_WMID_GET_GAMING_MISC_SETTING_METHODID,0x6,&result);
+     if(ACPI_FAILURE(status)){
+         pr_err("Error getting boot_animation_sound status: %s\n",acpi_format_exception(status));
+         return -ENODEV;
+     }
+     pr_info("boot_animation_sound get status: %llu\n",result);
+     return sprintf(buf, "%d\n", result == 0x100 ? 1 : result == 0 ? 0 : -1);
+ }
+ 
+ static ssize_t predator_boot_animation_sound_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+     acpi_status status;
+     u64 result;
+     u8 val;
+       if (sscanf(buf, "%hhd", &val) != 1)
+         return -EINVAL;
+       if ((val != 0) && (val != 1))
+         return -EINVAL;
+     pr_info("boot_animation_sound set value: %d\n",val);
+     status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_MISC_SETTING_METHODID,val == 1 ? 0x106 : 0x6, &result);
+     if(ACPI_FAILURE(status)){
+         pr_err("Error setting boot_animation_sound status: %s\n",acpi_format_exception(status));
+         return -ENODEV;
+     }
+     pr_info("boot_animation_sound set status: %llu\n",result);
+     return count;
+ }
+ 
+ static struct device_attribute profile_freq_cap = __ATTR(profile_freq_cap, 0644, profile_freq_cap_show, profile_freq_cap_store);
+ 
+ /* Performance presets, defined with the keyboard code below */
+ static ssize_t predator_preset_show(struct device *dev, struct device_attribute *attr, char *buf);
+ static ssize_t predator_preset_store(struct device *dev, struct device_attribute *attr,
+                                      const char *buf, size_t count);
+ 
+ /*
+  * predator sense attributes
+  */
+ static struct device_attribute boot_animation_sound = __ATTR(boot_animation_sound, 0644, predator_boot_animation_sound_show, predator_boot_animation_sound_store);
+ static struct device_attribute backlight_timeout = __ATTR(backlight_timeout, 0644, predator_backlight_timeout_show, predator_backlight_timeout_store);
+ static struct device_attribute usb_charging = __ATTR(usb_charging, 0644, predator_usb_charging_show, predator_usb_charging_store);
+ static struct device_attribute battery_calibration = __ATTR(battery_calibration, 0644, predator_battery_calibration_show, preadtor_battery_calibration_store);
+ static struct device_attribute battery_limiter = __ATTR(battery_limiter, 0644, predator_battery_limit_show, predator_battery_limit_store);
+ static struct device_attribute fan_speed = __ATTR(fan_speed, 0644, predator_fan_speed_show, predator_fan_speed_store);
+ static struct device_attribute lcd_override = __ATTR(lcd_override, 0644, predator_lcd_override_show, predator_lcd_override_store);
+ static struct device_attribute preset = __ATTR(preset, 0644, predator_preset_show, predator_preset_store);
+ static struct attribute *predator_sense_attrs[] = {
+     &lcd_override.attr,
+     &fan_speed.attr,
+     &battery_limiter.attr,
+     &battery_calibration.attr,
+     &usb_charging.attr,
+     &backlight_timeout.attr,
+     &boot_animation_sound.attr,
+     &preset.attr,
+     &profile_freq_cap.attr,
+     NULL
+ };
+ 
+ static struct attribute_group preadtor_sense_attr_group = {
+     .name = "predator_sense", .attrs = predator_sense_attrs
+ };
+ 
+ static struct attribute_group nitro_sense_v4_attr_group = {
+     .name = "nitro_sense", .attrs = predator_sense_attrs
+ };
+ 
+ /* nitro sense attributes */
+ static struct attribute *nitro_sense_attrs[] = {
+     &fan_speed.attr,
+     &battery_limiter.attr,
+     &battery_calibration.attr,
+     &usb_charging.attr,
+     &backlight_timeout.attr,
+     &profile_freq_cap.attr,
+     NULL
+ }; 
+ static struct attribute_group nitro_sense_attr_group = {
+     .name = "nitro_sense", .attrs = nitro_sense_attrs
+ };
+ 
+ /*
+  * CPU / GPU overclock
+  *
+  * Each OC setting can be changed on its own, without touching the turbo
+  * led or the fan mode. 0 is normal and 1 is turbo. The firmware has no
+  * call to list the OC levels it supports, so this is a fixed set (the
+  * same two values the turbo key uses). Each write is read back to catch
+  * a level the firmware silently ignores.
+  */
+ static int acer_oc_get(enum acer_wmi_gaming_misc_setting setting, int *val)
+ {
+     u8 oc;
+     int err;
+ 
+     err = WMID_gaming_get_misc_setting(setting, &oc);
+     if (err)
+         return err;
+ 
+     switch (oc) {
+     case ACER_WMID_OC_NORMAL:
+         *val = 0;
+         return 0;
+     case ACER_WMID_OC_TURBO:
+         *val = 1;
+         return 0;
+     default:
+         pr_err("unexpected OC value %u for setting %d\n", oc, setting);
+         return -EIO;
+     }
+ }
+ 
+ static int acer_oc_set(enum acer_wmi_gaming_misc_setting setting, int val)
+ {
+     struct acer_gaming_txn txn = ACER_GAMING_TXN("overclock");
+     int oc = val ? ACER_WMID_OC_TURBO : ACER_WMID_OC_NORMAL;
+     int old, err;
+ 
+     acer_state_restore_wait();
+ 
+     err = acer_oc_get(setting, &old);
+     if (err)
+         return err;
+     if (old == val)
+         return 0;
+ 
+     acer_txn_add(&txn, ACER_TXN_MISC_SETTING, setting, oc, 0);
+     err = acer_txn_commit(&txn);
+     if (err)
+         return err;
+ 
+     /* The firmware acks settings it silently ignores, verify it took effect */
+     err = acer_oc_get(setting, &old);
+     if (err)
+         return err;
+     if (old != val) {
+         pr_err("OC setting %d rejected by firmware\n", setting);
+         return -EIO;
+     }
+ 
+     return 0;
+ }
+ 
+ static ssize_t acer_oc_show(enum acer_wmi_gaming_misc_setting setting, char *buf)
+ {
+     int val, err;
+ 
+     err = acer_oc_get(setting, &val);
+     if (err)
+         return err;
+ 
+     return sprintf(buf, "%d\n", val);
+ }
+ 
+ static ssize_t acer_oc_store(enum acer_wmi_gaming_misc_setting setting, const char *buf,
+                              size_t count)
+ {
+     int val, err;
+ 
+     err = kstrtoint(buf, 10, &val);
+     if (err)
+         return err;
+     if (val != 0 && val != 1)
+         return -EINVAL;
+ 
+     err = acer_oc_set(setting, val);
+     if (err)
+         return err;
+ 
+     return count;
+ }
+ 
+ static ssize_t cpu_oc_show(struct device *dev, struct device_attribute *attr, char *buf)
+ {
+     return acer_oc_show(ACER_WMID_MISC_SETTING_OC_1, buf);
+ }
+ 
+ static ssize_t cpu_oc_store(struct device *dev, struct device_attribute *attr,
+                             const char *buf, size_t count)
+ {
+     return acer_oc_store(ACER_WMID_MISC_SETTING_OC_1, buf, count);
+ }
+ 
+ static ssize_t gpu_oc_show(struct device *dev, struct device_attribute *attr, char *buf)
+ {
+     return acer_oc_show(ACER_WMID_MISC_SETTING_OC_2, buf);
+ }
+ 
+ static ssize_t gpu_oc_store(struct device *dev, struct device_attribute *attr,
+                             const char *buf, size_t count)
+ {
+     return acer_oc_store(ACER_WMID_MISC_SETTING_OC_2, buf, count);
+ }
+ 
+ static struct device_attribute cpu_oc = __ATTR(cpu_oc, 0644, cpu_oc_show, cpu_oc_store);
+ static struct device_attribute gpu_oc = __ATTR(gpu_oc, 0644, gpu_oc_show, gpu_oc_store);
+ static struct attribute *overclock_attrs[] = {
+     &cpu_oc.attr,
+     &gpu_oc.attr,
+     NULL
+ };
+ static struct attribute_group overclock_attr_group = {
+     .name = "overclock", .attrs = overclock_attrs
+ };
+ 
+ /* Four Zoned Keyboard  */
+ 
+ struct get_four_zoned_kb_output {
+     u8 gmReturn;
+     u8 gmOutput[15];
+ } __packed;
+ 
+ static acpi_status set_kb_status(int mode, int speed, int brightness,
+                                  int direction, int red, int green, int blue){
+     u64 resp = 0;
+     u8 gmInput[16] = {mode, speed, brightness, 0, direction, red, green, blue, 3, 1, 0, 0, 0, 0, 0, 0};
+     
+     acpi_status status;
+     union acpi_object *obj;
+     struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
+     struct acpi_buffer input = { (acpi_size)sizeof(gmInput), (void *)(gmInput) };
+     
+     status = wmi_evaluate_method(WMID_GUID4, 0, ACER_WMID_SET_GAMING_KB_BACKLIGHT_METHODID, &input, &output);
+     if (ACPI_FAILURE(status))
+         return status;
+ 
+     obj = (union acpi_object *) output.pointer;
+ 
+     if (obj) {
+         if (obj->type == ACPI_TYPE_BUFFER) {
+             if (obj->buffer.length == sizeof(u32))
+                 resp = *((u32 *) obj->buffer.pointer);
+             else if (obj->buffer.length == sizeof(u64))
+                 resp = *((u64 *) obj->buffer.pointer);
+         } else if (obj->type == ACPI_TYPE_INTEGER) {
+             resp = (u64) obj->integer.value;
+         }
+     }
+ 
+     if(resp != 0){
+         pr_err("failed to set keyboard rgb: %llu\n",resp);
+         kfree(obj);
+         return AE_ERROR;
+     }
+ 
+     kfree(obj);
+     return status;
+ }
+ 
+ static acpi_status get_kb_status(struct get_four_zoned_kb_output *out){
+     u64 in = 1;
+     acpi_status status;
+     union acpi_object *obj;
+     struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
+     struct acpi_buffer input = { (acpi_size) sizeof(u64), (void *)(&in) };
+ 
+     status = wmi_evaluate_method(WMID_GUID4, 0, ACER_WMID_GET_GAMING_KB_BACKLIGHT_METHODID, &input, &output);
+     if (ACPI_FAILURE(status))
+         return status;
+     
+     obj = output.pointer;
+ 
+       if (!obj || obj->type != ACPI_TYPE_BUFFER || obj->buffer.length != 16) {
+         pr_err("Unexpected output format getting kb zone status, buffer "
+                "length:%d\n",
+                obj->buffer.length);
+         goto failed;
+       }
+ 
+       *out = *((struct get_four_zoned_kb_output  *)obj->buffer.pointer);
+ 
+     kfree(obj);
+     return AE_OK;
+ 
+     failed:
+           kfree(obj);
+           return AE_ERROR;
+ }
+ 
+ 
+ /* KB Backlight State  */;
+ 
+ struct per_zone_color {
+     u64 zone1, zone2, zone3, zone4;
+     int brightness;
+ } __packed;
+ 
+ struct kb_state {
+     u8 per_zone;
+     u8 mode;
+     u8 speed;
+     u8 brightness;
+     u8 direction;
+     u8 red;
+     u8 green;
+     u8 blue;
+     struct per_zone_color zones;
+ } __packed;
+ 
+ /*
+  * What the keyboard shows, updated on every successful write. Reads and
+  * saves are served from it, the firmware is only read while it is not
+  * valid (before the first read or after a failed write) or when a resync
+  * is forced through debugfs. Both are protected by kb_state_lock.
+  */
+ static struct kb_state current_kb_state;
+ static bool current_kb_state_valid;
+ static DEFINE_MUTEX(kb_state_lock);
+ 
+ /*
+  * Idle fade (see kb_idle_fn). While the backlight is faded out, saved holds
+  * the state from before the fade, which is what reads and saves report.
+  * Writes from anywhere else end the fade. phase and saved are protected by
+  * kb_state_lock.
+  */
+ enum kb_idle_phase {
+     KB_IDLE_ACTIVE,
+     KB_IDLE_FADING,
+     KB_IDLE_OFF,
+ };
+ 
+ static struct {
+     unsigned int timeout;       /* seconds, 0 when disabled */
+     unsigned long last_input;   /* jiffies */
+     enum kb_idle_phase phase;
+     int step;
+     struct kb_state saved;
+     bool registered;
+ } kb_idle;
+ 
+ /*
+  * A write took over the keyboard, kb_state_lock held. Ends a fade and
+  * restarts the timeout, the work is no longer pending once a fade is done.
+  */
+ static void kb_idle_mark_active(void)
+ {
+     unsigned int timeout = READ_ONCE(kb_idle.timeout);
+ 
+     lockdep_assert_held(&kb_state_lock);
+ 
+     WRITE_ONCE(kb_idle.phase, KB_IDLE_ACTIVE);
+     WRITE_ONCE(kb_idle.last_input, jiffies);
+     if (timeout)
+         mod_delayed_work(system_wq, &kb_idle_work, timeout * HZ);
+ }
+ 
+ static int four_zone_kb_get(struct kb_state *kb);
+ 
+ 
+ /* four zone mode */
+ static ssize_t four_zoned_rgb_kb_show(struct device *dev, struct device_attribute *attr,char *buf){
+     struct kb_state kb;
+ 
+     if (four_zone_kb_get(&kb))
+         return -ENODEV;
+     return sprintf(buf, "%d,%d,%d,%d,%d,%d,%d\n",kb.mode,kb.speed,kb.brightness,kb.direction,kb.red,kb.green,kb.blue);
+ }
+ 
+ static ssize_t four_zoned_rgb_kb_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+     acpi_status status;
+ 
+     int mode, speed, brightness, direction, red, green, blue;
+     char input_buf[30];
+     char *token;
+     char *input_ptr = input_buf;
+     size_t len = min(count, sizeof(input_buf) - 1);
+ 
+     strncpy(input_buf, buf, len);
+ 
+     if(input_buf[len-1] == '\n'){
+         input_buf[len-1] = '\0';
+     } else {
+         input_buf[len] = '\0';
+     }
+ 
+     token = strsep(&input_ptr, ",");
+     if (!token || kstrtoint(token, 10, &mode) || mode < 0 || mode > 7) {
+         pr_err("Invalid mode value.\n");
+         return -EINVAL;
+     }
+ 
+     token = strsep(&input_ptr, ",");
+     if (!token || kstrtoint(token, 10, &speed) || speed < 0 || speed > 9) {
+         pr_err("Invalid speed value.\n");
+         return -EINVAL;
+     }
+ 
+     token = strsep(&input_ptr, ",");
+     if (!token || kstrtoint(token, 10, &brightness) || brightness < 0 || brightness > 100) {
+         pr_err("Invalid brightness value.\n");
+         return -EINVAL;
+     }
+ 
+     token = strsep(&input_ptr, ",");
+     if (!token || kstrtoint(token, 10, &direction) || ((direction <= 0) && (mode == 0x3 || mode == 0x4 )) || direction < 0 || direction > 2) {
+         pr_err("Invalid direction value.\n");
+         return -EINVAL;
+     }
+ 
+     token = strsep(&input_ptr, ",");
+     if (!token || kstrtoint(token, 10, &red) || red < 0 || red > 255) {
+         pr_err("Invalid red value.\n");
+         return -EINVAL;
+     }
+ 
+     token = strsep(&input_ptr, ",");
+     if (!token || kstrtoint(token, 10, &green) || green < 0 || green > 255) {
+         pr_err("Invalid green value.\n");
+         return -EINVAL;
+     }
+ 
+     token = strsep(&input_ptr, ",");
+     if (!token || kstrtoint(token, 10, &blue) || blue < 0 || blue > 255) {
+         pr_err("Invalid blue value.\n");
+         return -EINVAL;
+     }
+ 
+     switch (mode) {
+         case 0x0:  // Static mode: Ignore speed and direction
+             speed = 0;
+             direction = 0;
+             break;
+         case 0x1:  // Breathing mode: Ignore speed
+             speed = 0;
+             direction = 0;
+             break;
+         case 0x2:  // Neon mode: Ignore red, green, blue, and direction
+             red = 0;
+             green = 0;
+             blue = 0;
+             direction = 0;
+             break;
+         case 0x3:  // Wave mode: Ignore red, green, and blue
+             red = 0;
+             green = 0;
+             blue = 0;
+             break;
+         case 0x4:  // Shifting mode: No restrictions (all values allowed)
+             break;
+         case 0x5:  // Zoom mode: Ignore direction
+             direction = 0;
+             break;
+         case 0x6:  // Meteor mode: Ignore direction
+             direction = 0;
+             break;
+         case 0x7:  // Twinkling mode: Ignore direction
+             direction = 0;
+             break;
+         default:
+             pr_err("Invalid mode value.\n");
+             return -EINVAL;
+     }
+ 
+     four_zone_effect_stop();
+ 
+     mutex_lock(&kb_state_lock);
+     status = set_kb_status(mode,speed,brightness,direction,red,green,blue);
+     if (ACPI_FAILURE(status)) {
+         mutex_unlock(&kb_state_lock);
+         pr_err("Error setting RGB KB status.\n");
+         return -ENODEV;
      }
  
-     return_value = *((struct event_return_value *)obj->buffer.pointer);
+     /* Set per_zone to 0 */
+     kb_idle_mark_active();
+     current_kb_state.per_zone = 0;
+     current_kb_state.mode = mode;
+     current_kb_state.speed = speed;
+     current_kb_state.brightness = brightness;
+     current_kb_state.direction = direction;
+     current_kb_state.red = red;
+     current_kb_state.green = green;
+     current_kb_state.blue = blue;
+     mutex_unlock(&kb_state_lock);
+ 
+     acer_state_mark_dirty();
+     return count;
+ }
  
-     switch (return_value.function) {
-     case WMID_HOTKEY_EVENT:
-         device_state = return_value.device_state;
-         pr_info("device state: 0x%x\n", device_state);
  
-         key = sparse_keymap_entry_from_scancode(acer_wmi_input_dev,
-                             return_value.key_num);
-         if (!key) {
-             pr_warn("Unknown key number - 0x%x\n",
-                 return_value.key_num);
-         } else {
-             scancode = return_value.key_num;
-             switch (key->keycode) {
-             case KEY_WLAN:
-             case KEY_BLUETOOTH:
-                 if (has_cap(ACER_CAP_WIRELESS))
-                     rfkill_set_sw_state(wireless_rfkill,
-                         !(device_state & ACER_WMID3_GDS_WIRELESS));
-                 if (has_cap(ACER_CAP_THREEG))
-                     rfkill_set_sw_state(threeg_rfkill,
-                         !(device_state & ACER_WMID3_GDS_THREEG));
-                 if (has_cap(ACER_CAP_BLUETOOTH))
-                     rfkill_set_sw_state(bluetooth_rfkill,
-                         !(device_state & ACER_WMID3_GDS_BLUETOOTH));
-                 break;
-             case KEY_TOUCHPAD_TOGGLE:
-                 scancode = (device_state & ACER_WMID3_GDS_TOUCHPAD) ?
-                         KEY_TOUCHPAD_ON : KEY_TOUCHPAD_OFF;
-             }
-             sparse_keymap_report_event(acer_wmi_input_dev, scancode, 1, true);
+ /* Per Zone Mode */
+ 
+ static acpi_status get_per_zone_color(struct per_zone_color *output) {
+     acpi_status status;
+     u64 *zones[] = { &output->zone1, &output->zone2, &output->zone3, &output->zone4 };
+     u8 zone_ids[] = { 0x1, 0x2, 0x4, 0x8 };
+ 
+     for (int i = 0; i < 4; i++) {
+         status = WMI_gaming_execute_u64(ACER_WMID_GET_GAMING_RGB_KB_METHODID, zone_ids[i], zones[i]);
+         if (ACPI_FAILURE(status)) {
+             pr_err("Error getting kb status (zone %d): %s\n", i + 1, acpi_format_exception(status));
+             return status;
          }
-         break;
-     case WMID_ACCEL_OR_KBD_DOCK_EVENT:
-         acer_gsensor_event();
-         acer_kbd_dock_event(&return_value);
-         break;
-     case WMID_GAMING_TURBO_KEY_EVENT:
-        pr_info("pressed turbo button - %d\n", return_value.key_num);
-         if (return_value.key_num == 0x4  && !has_cap(ACER_CAP_NITRO_SENSE_V4))
-             acer_toggle_turbo();
-         if ((return_value.key_num == 0x5 || (return_value.key_num == 0x4 && has_cap(ACER_CAP_NITRO_SENSE_V4))) && has_cap(ACER_CAP_PLATFORM_PROFILE))
-             acer_thermal_profile_change();
-         break;
-     case WMID_AC_EVENT:
-         if(has_cap(ACER_CAP_PREDATOR_SENSE) || has_cap(ACER_CAP_NITRO_SENSE_V4)){
-             if(return_value.key_num == 0){
-                 /* store the current state when it is connected to AC*/
-                 acer_predator_state_update(1);
-                 /* restore to the state when it was disconnected from AC*/
-                 acer_predator_state_restore(0);
-             } else if (return_value.key_num == 1){
-                 /* store the current state when it is disconnected from AC*/
-                 acer_predator_state_update(0);
-                 /* restore to the state when it was connected to AC*/
-                 acer_predator_state_restore(1);
-             } else {
-                 pr_info("Unknown key number - %d\n", return_value.key_num);
-             }
+         *zones[i] = cpu_to_be64(*zones[i]) >> 32;
+     }
+ 
+     /* Fetching Brighness Value */
+     struct get_four_zoned_kb_output out;
+     status = get_kb_status(&out);
+     if (ACPI_FAILURE(status)) {
+         pr_err("get kb status failed!");
+         return status;
+     }
+     output->brightness = out.gmOutput[2];
+     
+     return AE_OK;  
+ }
+ 
+ 
+ 
+ /* The firmware calls that take the keyboard from one per zone frame to another */
+ struct kb_zone_plan {
+     bool reset;         /* static mode reset at the new brightness */
+     int nr;
+     u8 mask[4];         /* zone id bits of each color write */
+     u64 color[4];
+ };
+ 
+ /*
+  * When the keyboard already shows a static per zone frame (in_static, last
+  * is that frame) only the difference is planned: the static mode reset is
+  * skipped unless the brightness changed, and only zones whose color changed
+  * are sent. The zone ids are bits, so with kb_merge_zones zones sharing a
+  * color go out as one call with the combined mask.
+  */
+ static void four_zone_kb_plan(const struct per_zone_color *zones,
+                               const struct per_zone_color *last, bool in_static,
+                               struct kb_zone_plan *plan)
+ {
+     const u64 want[] = { zones->zone1, zones->zone2, zones->zone3, zones->zone4 };
+     const u64 have[] = { last->zone1, last->zone2, last->zone3, last->zone4 };
+     u8 pending = 0;
+ 
+     for (int i = 0; i < 4; i++)
+         if (!in_static || want[i] != have[i])
+             pending |= BIT(i);
+ 
+     plan->reset = !in_static || zones->brightness != last->brightness;
+     plan->nr = 0;
+ 
+     for (int i = 0; i < 4; i++) {
+         u8 mask = BIT(i);
+ 
+         if (!(pending & mask))
+             continue;
+         if (kb_merge_zones)
+             for (int j = i + 1; j < 4; j++)
+                 if ((pending & BIT(j)) && want[j] == want[i])
+                     mask |= BIT(j);
+         pending &= ~mask;
+ 
+         plan->mask[plan->nr] = mask;
+         plan->color[plan->nr++] = want[i];
+     }
+ }
+ 
+ /*
+  * Write a per zone frame and keep current_kb_state in step, zones is not
+  * modified. Only the calls four_zone_kb_plan() asks for are made. Called
+  * with kb_state_lock held.
+  */
+ static acpi_status __four_zone_kb_write_zones(const struct per_zone_color *zones)
+ {
+     struct per_zone_color last = current_kb_state.zones;
+     bool in_static = current_kb_state_valid && current_kb_state.per_zone &&
+                      current_kb_state.mode == 0;
+     struct kb_zone_plan plan;
+     acpi_status status;
+ 
+     last.brightness = current_kb_state.brightness;
+     four_zone_kb_plan(zones, &last, in_static, &plan);
+ 
+     if (plan.reset) {
+         status = set_kb_status(0, 0, zones->brightness, 0, 0, 0, 0);
+         if (ACPI_FAILURE(status)) {
+             pr_err("Error setting KB status.\n");
+             current_kb_state_valid = false;
+             return status;
          }
-         break;
-     case WMID_BATTERY_BOOST_EVENT:
-         break;
-     case WMID_CALIBRATION_EVENT:
-         if(has_cap(ACER_CAP_PREDATOR_SENSE) || has_cap(ACER_CAP_NITRO_SENSE) || has_cap(ACER_CAP_NITRO_SENSE_V4)){
-             if (battery_health_set(CALIBRATION_MODE,return_value.key_num) != AE_OK){
-                 pr_err("Error changing calibration state\n");
-             }
+     }
+ 
+     for (int i = 0; i < plan.nr; i++) {
+         status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_RGB_KB_METHODID,
+                                         (cpu_to_be64(plan.color[i]) >> 32) | plan.mask[i],
+                                         NULL);
+         if (ACPI_FAILURE(status)) {
+             pr_err("Error setting KB color (zones %#x): %s\n", plan.mask[i],
+                    acpi_format_exception(status));
+             /* Part of the frame may have landed, write all of it next time */
+             current_kb_state_valid = false;
+             return status;
          }
-         break;
-     default:
-         pr_warn("Unknown function number - %d - %d\n",
-             return_value.function, return_value.key_num);
-         break;
      }
+ 
+     /* per zone mode also puts the keyboard in static mode at that brightness */
+     current_kb_state.per_zone = 1;
+     current_kb_state.zones = *zones;
+     current_kb_state.mode = 0;
+     current_kb_state.speed = 0;
+     current_kb_state.brightness = zones->brightness;
+     current_kb_state.direction = 0;
+     current_kb_state.red = 0;
+     current_kb_state.green = 0;
+     current_kb_state.blue = 0;
+     current_kb_state_valid = true;
+     return AE_OK;
  }
  
- static acpi_status __init
- wmid3_set_function_mode(struct func_input_params *params,
-             struct func_return_value *return_value)
+ static acpi_status four_zone_kb_write_zones(const struct per_zone_color *zones)
  {
      acpi_status status;
-     union acpi_object *obj;
  
-     struct acpi_buffer input = { sizeof(struct func_input_params), params };
-     struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
+     mutex_lock(&kb_state_lock);
+     kb_idle_mark_active();
+     status = __four_zone_kb_write_zones(zones);
+     mutex_unlock(&kb_state_lock);
+     return status;
+ }
+ 
+ static ssize_t per_zoned_rgb_kb_show(struct device *dev, struct device_attribute *attr,char *buf){
+     struct per_zone_color *output;
+     struct kb_state kb;
+ 
+     if (four_zone_kb_get(&kb))
+         return -ENODEV;
+     output = &kb.zones;
+     return sprintf(buf,"%06llx,%06llx,%06llx,%06llx,%d\n",output->zone1,output->zone2,output->zone3,output->zone4,kb.brightness);
+ }
+ 
+ static ssize_t per_zoned_rgb_kb_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+     int i = 0;
+     size_t len;
+     char *token;
+     char str_buf[34];
+     struct per_zone_color colors;
+     char *input_ptr = str_buf;
+     len = min(count, sizeof(str_buf) - 1);
+     strncpy(str_buf, buf, len);
+     if(str_buf[len-1] == '\n'){
+         str_buf[len-1] = '\0';
+     } else {
+         str_buf[len] = '\0';
+     }
+ 
+     acpi_status status;
+ 
+     /* zone1,zone2,zone3,zone4 */
+     
+     while ((token = strsep(&input_ptr, ",")) && i < 4) {
+         if (strlen(token) != 6) {
+             pr_err("Invalid rgb length: %s (%lu) (must be 3 bytes)\n", token, strlen(token));
+             return -EINVAL;
+         }
+         if (kstrtoull(token, 16, &((u64 *)&colors)[i])) {
+             pr_err("Invalid hex value: %s\n", token);
+             return -EINVAL;
+         }
+         i++;
+     }
+ 
+     if (!token || kstrtoint(token, 10, &colors.brightness) || colors.brightness < 0 || colors.brightness > 100) {
+         pr_err("Invalid brightness value.\n");
+         return -EINVAL;
+     }
+ 
+     four_zone_effect_stop();
+ 
+     /* set per zone colors */
+     status = four_zone_kb_write_zones(&colors);
+     if(ACPI_FAILURE(status)){
+         pr_err("Error setting RGB KB status.\n");
+         return -ENODEV;
+     }
+     acer_state_mark_dirty();
+     return count;
+ }
+ 
+ /* BackLight State */
+ 
+ /* Read the keyboard state from firmware, kb->per_zone is left untouched */
+ static int four_zone_kb_read(struct kb_state *kb) {
+     acpi_status status;
+     struct get_four_zoned_kb_output out;
+ 
+     // Get keyboard status
+     status = get_kb_status(&out);
+     if (ACPI_FAILURE(status)) {
+         pr_err("get kb status failed!");
+         return -1;
+     }
+ 
+     kb->mode = out.gmOutput[0];
+     kb->speed = out.gmOutput[1];
+     kb->brightness = out.gmOutput[2];
+     kb->direction = out.gmOutput[4]; 
+     kb->red = out.gmOutput[5];
+     kb->green = out.gmOutput[6];
+     kb->blue = out.gmOutput[7];
+ 
+     // Get per-zone color data
+     status = get_per_zone_color(&kb->zones);
+     if (ACPI_FAILURE(status)) {
+         pr_err("get_per_zone_color failed!");
+         return -1;
+     }
+     return 0;
+ }
+ 
+ /* Refresh current_kb_state from firmware */
+ static int four_zone_kb_state_update(void) {
+     int err;
+ 
+     mutex_lock(&kb_state_lock);
+     kb_idle_mark_active();
+     err = four_zone_kb_read(&current_kb_state);
+     current_kb_state_valid = !err;
+     mutex_unlock(&kb_state_lock);
+     return err;
+ }
+ 
+ /* Copy of current_kb_state, firmware is only read when it is not valid */
+ static int four_zone_kb_get(struct kb_state *kb) {
+     int err = 0;
+ 
+     mutex_lock(&kb_state_lock);
+     if (!current_kb_state_valid) {
+         err = four_zone_kb_read(&current_kb_state);
+         current_kb_state_valid = !err;
+     }
+     *kb = kb_idle.phase == KB_IDLE_ACTIVE ? current_kb_state : kb_idle.saved;
+     mutex_unlock(&kb_state_lock);
+     return err;
+ }
+ 
+ /* debugfs kb_resync: drop the cached keyboard state and read it back from firmware */
+ static ssize_t four_zone_kb_resync_write(struct file *file, const char __user *buf,
+                                          size_t count, loff_t *ppos)
+ {
+     return four_zone_kb_state_update() ? -EIO : count;
+ }
+ 
+ static const struct file_operations four_zone_kb_resync_fops = {
+     .write = four_zone_kb_resync_write,
+     .llseek = noop_llseek,
+ };
  
-     status = wmi_evaluate_method(WMID_GUID3, 0, 0x1, &input, &output);
-     if (ACPI_FAILURE(status))
-         return status;
+ /* Whether the keyboard shows what want asks for */
+ static bool four_zone_kb_state_matches(const struct kb_state *want, const struct kb_state *have)
+ {
+     if (want->per_zone)
+         return !memcmp(&want->zones, &have->zones, sizeof(want->zones));
  
-     obj = output.pointer;
+     return want->mode == have->mode && want->speed == have->speed &&
+            want->brightness == have->brightness && want->direction == have->direction &&
+            want->red == have->red && want->green == have->green && want->blue == have->blue;
+ }
  
-     if (!obj)
-         return AE_ERROR;
-     else if (obj->type != ACPI_TYPE_BUFFER) {
-         kfree(obj);
-         return AE_ERROR;
-     }
-     if (obj->buffer.length != 4) {
-         pr_warn("Unknown buffer length %d\n", obj->buffer.length);
-         kfree(obj);
-         return AE_ERROR;
+ /* Called with kb_state_lock held */
+ static acpi_status __four_zone_kb_apply(const struct kb_state *kb)
+ {
+     acpi_status status;
+ 
+     if (kb->per_zone)
+         status = __four_zone_kb_write_zones(&kb->zones);
+     else
+         status = set_kb_status(kb->mode, kb->speed, kb->brightness, kb->direction,
+                                kb->red, kb->green, kb->blue);
+     if (ACPI_SUCCESS(status)) {
+         current_kb_state = *kb;
+         current_kb_state_valid = true;
      }
+     return status;
+ }
  
-     *return_value = *((struct func_return_value *)obj->buffer.pointer);
-     kfree(obj);
+ static acpi_status four_zone_kb_apply(const struct kb_state *kb)
+ {
+     acpi_status status;
  
+     mutex_lock(&kb_state_lock);
+     kb_idle_mark_active();
+     status = __four_zone_kb_apply(kb);
+     mutex_unlock(&kb_state_lock);
      return status;
  }
  
- static int __init acer_wmi_enable_ec_raw(void)
+ static bool four_zone_kb_state_valid(const struct kb_state *kb)
  {
-     struct func_return_value return_value;
-     acpi_status status;
-     struct func_input_params params = {
-         .function_num = 0x1,
-         .commun_devices = 0xFFFF,
-         .devices = 0xFFFF,
-         .app_status = 0x00,		/* Launch Manager Deactive */
-         .app_mask = 0x01,
-     };
+     const struct per_zone_color *z = &kb->zones;
  
-     status = wmid3_set_function_mode(&params, &return_value);
+     if (kb->per_zone > 1 || kb->mode > 7 || kb->speed > 9 ||
+         kb->brightness > 100 || kb->direction > 2)
+         return false;
  
-     if (return_value.error_code || return_value.ec_return_value)
-         pr_warn("Enabling EC raw mode failed: 0x%x - 0x%x\n",
-             return_value.error_code,
-             return_value.ec_return_value);
-     else
-         pr_info("Enabled EC raw mode\n");
+     return z->zone1 <= 0xffffff && z->zone2 <= 0xffffff && z->zone3 <= 0xffffff &&
+            z->zone4 <= 0xffffff && z->brightness >= 0 && z->brightness <= 100;
+ }
  
-     return status;
+ /*
+  * Persisted state attribute
+  *
+  * Reading acer-wmi/state returns the power source states and the keyboard
+  * state as container records, writing it back restores them. This keeps all
+  * file I/O in userspace, linuwu_sense.service saves the blob at shutdown and
+  * writes it back once the module is loaded.
+  */
+ #define ACER_STATE_BLOB_MAX (2 * sizeof(struct acer_state_header) + ACER_STATE_MAX_PAYLOAD * 2)
+ 
+ static_assert(sizeof(struct power_states) <= ACER_STATE_MAX_PAYLOAD);
+ static_assert(sizeof(struct kb_state) <= ACER_STATE_MAX_PAYLOAD);
+ 
+ static bool acer_state_has_power(void)
+ {
+     return has_cap(ACER_CAP_PREDATOR_SENSE) || has_cap(ACER_CAP_NITRO_SENSE_V4);
  }
  
- static int __init acer_wmi_enable_lm(void)
+ static ssize_t acer_state_blob_read(struct file *filp, struct kobject *kobj,
+                                     const struct bin_attribute *attr, char *buf,
+                                     loff_t off, size_t count)
  {
-     struct func_return_value return_value;
+     u8 blob[ACER_STATE_BLOB_MAX];
+     struct kb_state kb;
+     size_t size = 0;
      acpi_status status;
-     struct func_input_params params = {
-         .function_num = 0x1,
-         .commun_devices = 0xFFFF,
-         .devices = 0xFFFF,
-         .app_status = 0x01,            /* Launch Manager Active */
-         .app_mask = 0x01,
-     };
- 
-     status = wmid3_set_function_mode(&params, &return_value);
+     u64 on_AC;
+     int on_ac, err;
  
-     if (return_value.error_code || return_value.ec_return_value)
-         pr_warn("Enabling Launch Manager failed: 0x%x - 0x%x\n",
-             return_value.error_code,
-             return_value.ec_return_value);
+     /*
+      * Built from the shadow state, this runs on the way down at shutdown.
+      * Firmware is only asked for what the driver has not seen yet.
+      */
+     if (acer_state_has_power()) {
+         on_ac = READ_ONCE(acer_on_ac);
+         if (on_ac < 0) {
+             status = WMI_gaming_execute_u64(ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
+                                             ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS, &on_AC);
+             if (ACPI_FAILURE(status))
+                 return -EIO;
+             on_ac = on_AC ? 1 : 0;
+         }
+         mutex_lock(&acer_state_apply_lock);
+         err = acer_predator_state_update(on_ac);
+         if (!err)
+             size += acer_state_pack(ACER_STATE_POWER, &current_states,
+                                     sizeof(current_states), blob + size);
+         mutex_unlock(&acer_state_apply_lock);
+         if (err)
+             return -EIO;
+     }
+     if (quirks->four_zone_kb) {
+         if (four_zone_kb_get(&kb))
+             return -EIO;
+         size += acer_state_pack(ACER_STATE_KB, &kb, sizeof(kb), blob + size);
+     }
  
-     return status;
+     return memory_read_from_buffer(buf, count, &off, blob, size);
  }
  
- static int __init acer_wmi_enable_rf_button(void)
+ static int acer_state_apply_power(const struct power_states *states)
  {
-     struct func_return_value return_value;
-     acpi_status status;
-     struct func_input_params params = {
-         .function_num = 0x1,
-         .commun_devices = 0xFFFF,
-         .devices = 0xFFFF,
-         .app_status = 0x10,            /* RF Button Active */
-         .app_mask = 0x10,
-     };
+     if (!acer_state_has_power())
+         return 0;
+     if (!acer_predator_state_valid(&states->battery_state) ||
+         !acer_predator_state_valid(&states->ac_state))
+         return -EINVAL;
  
-     status = wmid3_set_function_mode(&params, &return_value);
+     current_states = *states;
+     return acer_predator_state_init() ? -EIO : 0;
+ }
  
-     if (return_value.error_code || return_value.ec_return_value)
-         pr_warn("Enabling RF Button failed: 0x%x - 0x%x\n",
-             return_value.error_code,
-             return_value.ec_return_value);
+ static int acer_state_apply_kb(const struct kb_state *kb)
+ {
+     if (!quirks->four_zone_kb)
+         return 0;
+     if (!four_zone_kb_state_valid(kb))
+         return -EINVAL;
  
-     return status;
+     /* Shared by the state attribute and the config firmware */
+     four_zone_effect_stop();
+     return ACPI_FAILURE(four_zone_kb_apply(kb)) ? -EIO : 0;
  }
  
- static int __init acer_wmi_accel_setup(void)
+ /* Decode and apply a state blob, shared by the state attribute and the config firmware */
+ static int acer_state_apply_blob(const u8 *buf, size_t count)
  {
-     struct acpi_device *adev;
+     struct power_states states;
+     struct kb_state kb;
+     bool have_states = false, have_kb = false;
+     size_t pos = 0;
+     ssize_t rec;
      int err;
  
-     adev = acpi_dev_get_first_match_dev("BST0001", NULL, -1);
-     if (!adev)
-         return -ENODEV;
+     acer_state_restore_wait();
  
-     gsensor_handle = acpi_device_handle(adev);
-     acpi_dev_put(adev);
+     /* Version 0 files, the bare structs */
+     if (count == sizeof(states) && get_unaligned_le32(buf) != ACER_STATE_MAGIC) {
+         memcpy(&states, buf, sizeof(states));
+         have_states = true;
+         pos = count;
+     } else if (count == sizeof(kb) && get_unaligned_le32(buf) != ACER_STATE_MAGIC) {
+         memcpy(&kb, buf, sizeof(kb));
+         have_kb = true;
+         pos = count;
+     }
  
-     acer_wmi_accel_dev = input_allocate_device();
-     if (!acer_wmi_accel_dev)
-         return -ENOMEM;
+     /* Decode everything before touching the firmware */
+     while (pos < count) {
+         const struct acer_state_header *hdr = (const void *)(buf + pos);
  
-     acer_wmi_accel_dev->open = acer_gsensor_open;
+         rec = acer_state_check(buf + pos, count - pos);
+         if (rec < 0)
+             return rec;
  
-     acer_wmi_accel_dev->name = "Acer BMA150 accelerometer";
-     acer_wmi_accel_dev->phys = "wmi/input1";
-     acer_wmi_accel_dev->id.bustype = BUS_HOST;
-     acer_wmi_accel_dev->evbit[0] = BIT_MASK(EV_ABS);
-     input_set_abs_params(acer_wmi_accel_dev, ABS_X, -16384, 16384, 0, 0);
-     input_set_abs_params(acer_wmi_accel_dev, ABS_Y, -16384, 16384, 0, 0);
-     input_set_abs_params(acer_wmi_accel_dev, ABS_Z, -16384, 16384, 0, 0);
+         switch (le16_to_cpu(hdr->type)) {
+         case ACER_STATE_POWER:
+             err = acer_state_decode(hdr, &states, sizeof(states));
+             have_states = !err;
+             break;
+         case ACER_STATE_KB:
+             err = acer_state_decode(hdr, &kb, sizeof(kb));
+             have_kb = !err;
+             break;
+         default:
+             /* Records from newer drivers are skipped */
+             err = 0;
+             break;
+         }
+         if (err)
+             return err;
+         pos += rec;
+     }
  
-     err = input_register_device(acer_wmi_accel_dev);
-     if (err)
-         goto err_free_dev;
+     if (have_states) {
+         err = acer_state_apply_power(&states);
+         if (err)
+             return err;
+     }
+     if (have_kb) {
+         err = acer_state_apply_kb(&kb);
+         if (err)
+             return err;
+     }
  
      return 0;
- 
- err_free_dev:
-     input_free_device(acer_wmi_accel_dev);
-     return err;
  }
  
- static int __init acer_wmi_input_setup(void)
+ /*
+  * Set once userspace has restored its saved state, which wins over the config
+  * firmware. Blob applies are serialized by acer_state_apply_lock and the flag
+  * is only touched under it, so a config firmware that arrives late can't
+  * overwrite a state userspace is writing at the same time.
+  */
+ static bool acer_state_user_written;
+ 
+ static ssize_t acer_state_blob_write(struct file *filp, struct kobject *kobj,
+                                      const struct bin_attribute *attr, char *buf,
+                                      loff_t off, size_t count)
  {
-     acpi_status status;
      int err;
  
-     acer_wmi_input_dev = input_allocate_device();
-     if (!acer_wmi_input_dev)
-         return -ENOMEM;
+     /* The whole blob has to come in a single write */
+     if (off != 0)
+         return -EINVAL;
  
-     acer_wmi_input_dev->name = "Acer WMI hotkeys";
-     acer_wmi_input_dev->phys = "wmi/input0";
-     acer_wmi_input_dev->id.bustype = BUS_HOST;
+     mutex_lock(&acer_state_apply_lock);
+     err = acer_state_apply_blob(buf, count);
+     if (!err)
+         acer_state_user_written = true;
+     mutex_unlock(&acer_state_apply_lock);
  
-     err = sparse_keymap_setup(acer_wmi_input_dev, acer_wmi_keymap, NULL);
-     if (err)
-         goto err_free_dev;
+     return err ? err : count;
+ }
  
-     if (has_cap(ACER_CAP_KBD_DOCK))
-         input_set_capability(acer_wmi_input_dev, EV_SW, SW_TABLET_MODE);
+ static const struct bin_attribute acer_state_blob =
+     __BIN_ATTR(state, 0600, acer_state_blob_read, acer_state_blob_write, 0);
  
-     status = wmi_install_notify_handler(ACERWMID_EVENT_GUID,
-                         acer_wmi_notify, NULL);
-     if (ACPI_FAILURE(status)) {
-         err = -EIO;
-         goto err_free_dev;
+ /*
+  * Default configuration from the firmware loader
+  *
+  * A blob in the same format as the state attribute, looked up as
+  * config_firmware (linuwu_sense/config.bin by default) in the firmware
+  * search path, which includes the initramfs. It lets an image ship default
+  * profiles, fan speeds and keyboard lighting. The request is asynchronous so
+  * probe does not wait on the root filesystem, and a state already restored
+  * by userspace takes precedence.
+  */
+ static char *config_firmware = "linuwu_sense/config.bin";
+ module_param(config_firmware, charp, 0444);
+ MODULE_PARM_DESC(config_firmware, "Default configuration loaded through the firmware loader (empty to disable)");
+ 
+ static DECLARE_COMPLETION(acer_config_fw_done);
+ static bool acer_config_fw_pending;
+ 
+ static void acer_config_fw_loaded(const struct firmware *fw, void *context)
+ {
+     int err;
+ 
+     mutex_lock(&acer_state_apply_lock);
+     if (!fw) {
+         pr_debug("No default configuration %s\n", config_firmware);
+     } else if (acer_state_user_written) {
+         pr_info("Saved state already restored, ignoring %s\n", config_firmware);
+     } else {
+         err = acer_state_apply_blob(fw->data, fw->size);
+         if (err)
+             pr_err("Invalid default configuration %s: %d\n", config_firmware, err);
+         else
+             pr_info("Default configuration %s applied\n", config_firmware);
      }
+     mutex_unlock(&acer_state_apply_lock);
  
-     if (has_cap(ACER_CAP_KBD_DOCK))
-         acer_kbd_dock_get_initial_state();
+     release_firmware(fw);
+     complete(&acer_config_fw_done);
+ }
  
-     err = input_register_device(acer_wmi_input_dev);
-     if (err)
-         goto err_uninstall_notifier;
+ static void acer_config_fw_request(struct device *dev)
+ {
+     int err;
  
-     return 0;
+     if (!config_firmware || !*config_firmware)
+         return;
  
- err_uninstall_notifier:
-     wmi_remove_notify_handler(ACERWMID_EVENT_GUID);
- err_free_dev:
-     input_free_device(acer_wmi_input_dev);
-     return err;
+     /* Most images ship no config, so a missing file is not worth a warning */
+     err = firmware_request_nowait_nowarn(THIS_MODULE, config_firmware, dev, GFP_KERNEL,
+                                          NULL, acer_config_fw_loaded);
+     if (err) {
+         pr_warn("Failed to request %s: %d\n", config_firmware, err);
+         return;
+     }
+     acer_config_fw_pending = true;
  }
  
- static void acer_wmi_input_destroy(void)
+ static void acer_config_fw_wait(void)
  {
-     wmi_remove_notify_handler(ACERWMID_EVENT_GUID);
-     input_unregister_device(acer_wmi_input_dev);
+     if (acer_config_fw_pending)
+         wait_for_completion(&acer_config_fw_done);
+     acer_config_fw_pending = false;
  }
  
  /*
-  * debugfs functions
+  * Performance presets
+  *
+  * A preset bundles the thermal profile, fan speeds, lcd override, usb
+  * charging and keyboard lighting under a name. "save <name>" captures the
+  * current settings, "apply <name>" restores them in one transaction and
+  * only touches the settings whose value differs from the current one.
   */
- static u32 get_wmid_devices(void)
+ #define ACER_PRESET_SLOTS 4
+ #define ACER_PRESET_NAME_LEN 16
+ 
+ struct acer_preset {
+     char name[ACER_PRESET_NAME_LEN];
+     int thermal_profile;
+     int cpu_fan_speed;
+     int gpu_fan_speed;
+     int lcd_override;   /* -1 if unknown */
+     int usb_charging;   /* -1 if unknown */
+     bool has_kb;
+     struct kb_state kb;
+ };
+ 
+ static struct acer_preset acer_presets[ACER_PRESET_SLOTS];
+ static DEFINE_MUTEX(acer_preset_lock);
+ 
+ static struct acer_preset *acer_preset_find(const char *name)
  {
-     struct acpi_buffer out = {ACPI_ALLOCATE_BUFFER, NULL};
-     union acpi_object *obj;
-     acpi_status status;
-     u32 devices = 0;
+     for (int i = 0; i < ACER_PRESET_SLOTS; i++)
+         if (acer_presets[i].name[0] && !strcmp(acer_presets[i].name, name))
+             return &acer_presets[i];
  
-     status = wmi_query_block(WMID_GUID2, 0, &out);
-     if (ACPI_FAILURE(status))
-         return 0;
+     return NULL;
+ }
  
-     obj = (union acpi_object *) out.pointer;
-     if (obj) {
-         if (obj->type == ACPI_TYPE_BUFFER &&
-             (obj->buffer.length == sizeof(u32) ||
-             obj->buffer.length == sizeof(u64))) {
-             devices = *((u32 *) obj->buffer.pointer);
-         } else if (obj->type == ACPI_TYPE_INTEGER) {
-             devices = (u32) obj->integer.value;
-         }
-     }
+ static int acer_preset_save(const char *name)
+ {
+     struct acer_preset *p = acer_preset_find(name);
+     u8 tp;
+     int err;
  
-     kfree(out.pointer);
-     return devices;
+     for (int i = 0; !p && i < ACER_PRESET_SLOTS; i++)
+         if (!acer_presets[i].name[0])
+             p = &acer_presets[i];
+     if (!p)
+         return -ENOSPC;
+ 
+     err = acer_thermal_profile_read(&tp);
+     if (err)
+         return err;
+ 
+     memset(p, 0, sizeof(*p));
+     strscpy(p->name, name, sizeof(p->name));
+     p->thermal_profile = tp;
+     mutex_lock(&acer_gaming_lock);
+     p->cpu_fan_speed = cpu_fan_speed;
+     p->gpu_fan_speed = gpu_fan_speed;
+     if (ACPI_FAILURE(acer_lcd_override_get(&p->lcd_override)))
+         p->lcd_override = -1;
+     if (ACPI_FAILURE(acer_usb_charging_get(&p->usb_charging)))
+         p->usb_charging = -1;
+     mutex_unlock(&acer_gaming_lock);
+     if (quirks->four_zone_kb && !four_zone_kb_get(&p->kb))
+         p->has_kb = true;
+ 
+     pr_info("preset %s saved\n", name);
+     return 0;
  }
  
- static int acer_wmi_hwmon_init(void);
+ static int acer_preset_apply(const struct acer_preset *p)
+ {
+     struct kb_state kb;
+     struct acer_gaming_txn txn = ACER_GAMING_TXN_USER("preset");
+     bool profile_changed = false;
+     u8 tp;
+     int err;
  
+     if (acer_thermal_profile_read(&tp) || tp != p->thermal_profile) {
+         u64 on_AC;
  
- /*
-  * USB Charging
-  */
- static ssize_t predator_usb_charging_show(struct device *dev, struct device_attribute *attr,char *buf){
-     acpi_status status;
-     u64 result;
-     status = WMI_apgeaction_execute_u64(ACER_WMID_GET_FUNCTION,0x4,&result);
-     if(ACPI_FAILURE(status)){
-         pr_err("Error getting usb charging status: %s\n",acpi_format_exception(status));
-         return -ENODEV;
+         /* Same restriction as the platform profile: no high profiles on battery */
+         if (ACPI_FAILURE(WMI_gaming_execute_u64(ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
+                                                 ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS, &on_AC)))
+             return -EIO;
+         if (!on_AC && p->thermal_profile != ACER_PREDATOR_V4_THERMAL_PROFILE_ECO &&
+             p->thermal_profile != ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED)
+             return -EOPNOTSUPP;
+ 
+         acer_txn_add_profile(&txn, p->thermal_profile);
+         profile_changed = true;
+     }
+     if (p->cpu_fan_speed != cpu_fan_speed || p->gpu_fan_speed != gpu_fan_speed)
+         acer_txn_add_fan_speed(&txn, p->cpu_fan_speed, p->gpu_fan_speed);
+     if (p->lcd_override >= 0 && p->lcd_override != lcd_override_state)
+         acer_txn_add(&txn, ACER_TXN_LCD_OVERRIDE, 0, p->lcd_override, 0);
+     if (p->usb_charging >= 0 && p->usb_charging != usb_charging_state)
+         acer_txn_add(&txn, ACER_TXN_USB_CHARGING, 0, p->usb_charging, 0);
+ 
+     err = acer_txn_commit(&txn);
+     if (err)
+         return err;
+ 
+     if (profile_changed) {
+         if (p->thermal_profile != acer_predator_v4_max_perf)
+             last_non_turbo_profile = p->thermal_profile;
+         if (platform_profile_support)
+             platform_profile_notify(platform_profile_device);
+     }
+ 
+     /* Lighting is applied last, a failure here leaves the thermal settings in place */
+     if (p->has_kb && quirks->four_zone_kb) {
+         /* A running effect would paint over the preset on its next frame */
+         four_zone_effect_stop();
+         if (four_zone_kb_get(&kb) || memcmp(&p->kb, &kb, sizeof(kb))) {
+             if (ACPI_FAILURE(four_zone_kb_apply(&p->kb)))
+                 return -EIO;
+             acer_state_mark_dirty();
+         }
+     }
+ 
+     pr_info("preset %s applied (%d firmware writes)\n", p->name, txn.nr_ops);
+     return 0;
+ }
+ 
+ static ssize_t predator_preset_show(struct device *dev, struct device_attribute *attr, char *buf)
+ {
+     int len = 0;
+ 
+     mutex_lock(&acer_preset_lock);
+     for (int i = 0; i < ACER_PRESET_SLOTS; i++) {
+         const struct acer_preset *p = &acer_presets[i];
+ 
+         if (!p->name[0])
+             continue;
+         len += sysfs_emit_at(buf, len, "%s: profile=%d fan_speed=%d,%d lcd_override=%d usb_charging=%d kb=%s\n",
+                              p->name, p->thermal_profile, p->cpu_fan_speed, p->gpu_fan_speed,
+                              p->lcd_override, p->usb_charging,
+                              !p->has_kb ? "none" : p->kb.per_zone ? "per_zone" : "four_zone");
      }
-     pr_info("usb charging get status: %llu\n",result);
-     return sprintf(buf, "%d\n", result == 663296 ? 0 : result == 659200 ? 10 : result == 1314560 ? 20 : result == 1969920 ? 30 : -1); //-1 means unknown value
+     mutex_unlock(&acer_preset_lock);
+ 
+     return len;
  }
  
- static ssize_t predator_usb_charging_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
-     acpi_status status;
-     u64 result;
-     u8 val;
-       if (sscanf(buf, "%hhd", &val) != 1)
-         return -EINVAL;
-       if ((val != 0) && (val != 10) && (val != 20) && (val != 30))
+ static ssize_t predator_preset_store(struct device *dev, struct device_attribute *attr,
+                                      const char *buf, size_t count)
+ {
+     char cmd[8], name[ACER_PRESET_NAME_LEN];
+     struct acer_preset *p;
+     int err;
+ 
+     /* <save|apply|delete> <name> */
+     if (sscanf(buf, "%7s %15s", cmd, name) != 2)
          return -EINVAL;
-     pr_info("usb charging set value: %d\n",val);
-     status = WMI_apgeaction_execute_u64(ACER_WMID_SET_FUNCTION,val == 0 ? 663300 : val == 10 ? 659204 : val == 20 ? 1314564 : val == 30 ? 1969924 : 663300, &result); //if unkown value then turn it off.
-     if(ACPI_FAILURE(status)){
-         pr_err("Error setting usb charging status: %s\n",acpi_format_exception(status));
-         return -ENODEV;
+ 
+     acer_state_restore_wait();
+ 
+     mutex_lock(&acer_preset_lock);
+     if (!strcmp(cmd, "save")) {
+         err = acer_preset_save(name);
+     } else if (!strcmp(cmd, "apply")) {
+         p = acer_preset_find(name);
+         err = p ? acer_preset_apply(p) : -ENOENT;
+     } else if (!strcmp(cmd, "delete")) {
+         p = acer_preset_find(name);
+         if (p)
+             memset(p, 0, sizeof(*p));
+         err = p ? 0 : -ENOENT;
+     } else {
+         err = -EINVAL;
      }
-     pr_info("usb charging set status: %llu\n",result);
-     return count;
+     mutex_unlock(&acer_preset_lock);
+ 
+     return err ? err : count;
  }
  
  /*
-  * Battery Limit (80%)
-  * Battery Calibration
+  * Keyboard effect engine
+  *
+  * Plays a loop of up to KB_EFFECT_MAX_KEYFRAMES per zone keyframes, fading
+  * linearly from each keyframe to the next over its duration. Frames are
+  * computed from a delayed work at effect_fps and only written when they
+  * differ from the previous one. Writing four_zone_mode or per_zone_mode
+  * stops the effect.
+  *
+  * effect takes "<ms>:<zone1>,<zone2>,<zone3>,<zone4>,<brightness>" keyframes
+  * separated by ';', e.g. "500:ff0000,000000,000000,000000,100;500:000000,
+  * ff0000,000000,000000,100", or "stop".
   */
- struct get_battery_health_control_status_input {
-     u8 uBatteryNo;
-     u8 uFunctionQuery;
-     u8 uReserved[2];
- } __packed;
+ #define KB_EFFECT_MAX_KEYFRAMES 16
+ #define KB_EFFECT_MAX_FPS       30
  
- struct get_battery_health_control_status_output {
-     u8 uFunctionList;
-     u8 uReturn[2];
-     u8 uFunctionStatus[5];
- } __packed;
+ struct kb_keyframe {
+     u32 color[4];
+     int brightness;
+     unsigned int duration_ms;
+ };
  
- struct set_battery_health_control_input {
-     u8 uBatteryNo;
-     u8 uFunctionMask;
-     u8 uFunctionStatus;
-     u8 uReservedIn[5];
- } __packed;
+ static struct {
+     struct kb_keyframe kf[KB_EFFECT_MAX_KEYFRAMES];
+     int nr;
+     u32 cycle_ms;
+     unsigned int period_ms;
+     bool running;
+     ktime_t start;
+     u64 last_tick;
+     u64 frames;
+     u64 writes;
+     u64 dropped;
+     ktime_t window_start;
+     unsigned int window_frames;
+     unsigned int achieved_fps;
+     struct per_zone_color last;
+ } kb_effect;
+ 
+ static DEFINE_MUTEX(kb_effect_lock);
+ static unsigned int kb_effect_fps = 10;
+ 
+ static void four_zone_effect_fn(struct work_struct *work);
+ static DECLARE_DELAYED_WORK(kb_effect_work, four_zone_effect_fn);
+ 
+ static u32 kb_effect_lerp_rgb(u32 a, u32 b, u32 num, u32 den)
+ {
+     u32 out = 0;
  
- struct set_battery_health_control_output {
-     u8 uReturn;
-     u8 uReservedOut;
- } __packed;
+     for (int shift = 0; shift <= 16; shift += 8) {
+         int ca = (a >> shift) & 0xff, cb = (b >> shift) & 0xff;
  
+         out |= (u32)(ca + (cb - ca) * (int)num / (int)den) << shift;
+     }
+     return out;
+ }
  
- static acpi_status battery_health_query(int mode, int *enabled){
-     pr_info("battery health query: %d\n",mode);
-     acpi_status status;
-     union acpi_object *obj;
-     struct get_battery_health_control_status_input params = {
-         .uBatteryNo = 0x1,
-         .uFunctionQuery = 0x1,
-         .uReserved = { 0x0, 0x0 }
-     };
-     struct get_battery_health_control_status_output ret;
+ /* Frame at t ms into the cycle, kb_effect_lock held */
+ static void kb_effect_render(u32 t, struct per_zone_color *frame)
+ {
+     const struct kb_keyframe *a, *b;
+     u64 *zones[] = { &frame->zone1, &frame->zone2, &frame->zone3, &frame->zone4 };
+     int i = 0;
  
-     struct acpi_buffer input = {
-         sizeof(struct get_battery_health_control_status_input), &params
-     };
+     while (t >= kb_effect.kf[i].duration_ms) {
+         t -= kb_effect.kf[i].duration_ms;
+         i++;
+     }
+     a = &kb_effect.kf[i];
+     b = &kb_effect.kf[(i + 1) % kb_effect.nr];
  
-     struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
+     for (int z = 0; z < 4; z++)
+         *zones[z] = kb_effect_lerp_rgb(a->color[z], b->color[z], t, a->duration_ms);
+     frame->brightness = a->brightness +
+         (b->brightness - a->brightness) * (int)t / (int)a->duration_ms;
+ }
  
-     status = wmi_evaluate_method(WMID_GUID5, 0, ACER_WMID_GET_BATTERY_HEALTH_CONTROL_STATUS_METHODID, &input, &output);
-     if (ACPI_FAILURE(status))
-         return status;
-     
-     obj = output.pointer;
+ static void four_zone_effect_fn(struct work_struct *work)
+ {
+     struct per_zone_color frame;
+     ktime_t now, next;
+     u64 elapsed_ms, tick;
+     u32 pos;
  
-       if (!obj || obj->type != ACPI_TYPE_BUFFER || obj->buffer.length != 8) {
-         pr_err("Unexpected output format getting battery health status, buffer "
-                "length:%d\n",
-                obj->buffer.length);
-         goto failed;
-       }
-     
-       ret = *((struct get_battery_health_control_status_output *)obj->buffer.pointer);
-     
-     if(mode == HEALTH_MODE){
-         *enabled = ret.uFunctionStatus[0];
-     } else if(mode == CALIBRATION_MODE){
-         *enabled = ret.uFunctionStatus[1];
-     } else {
-         goto failed;
+     mutex_lock(&kb_effect_lock);
+     if (!kb_effect.running)
+         goto out;
+ 
+     now = ktime_get();
+     elapsed_ms = ktime_ms_delta(now, kb_effect.start);
+     tick = div_u64(elapsed_ms, kb_effect.period_ms);
+ 
+     /* Ticks that went by while we were late are lost frames */
+     if (kb_effect.frames && tick > kb_effect.last_tick + 1)
+         kb_effect.dropped += tick - kb_effect.last_tick - 1;
+     kb_effect.last_tick = tick;
+ 
+     div_u64_rem(elapsed_ms, kb_effect.cycle_ms, &pos);
+     kb_effect_render(pos, &frame);
+     if (!kb_effect.frames || memcmp(&frame, &kb_effect.last, sizeof(frame))) {
+         if (ACPI_FAILURE(four_zone_kb_write_zones(&frame))) {
+             pr_err("Keyboard effect stopped, failed to write frame\n");
+             kb_effect.running = false;
+             goto out;
+         }
+         kb_effect.last = frame;
+         kb_effect.writes++;
      }
+     kb_effect.frames++;
  
-     kfree(obj);
-     return AE_OK;
+     kb_effect.window_frames++;
+     if (ktime_ms_delta(now, kb_effect.window_start) >= MSEC_PER_SEC) {
+         kb_effect.achieved_fps = kb_effect.window_frames;
+         kb_effect.window_frames = 0;
+         kb_effect.window_start = now;
+     }
  
-     failed:
-           kfree(obj);
-           return AE_ERROR;
+     next = ktime_add_ms(kb_effect.start, (tick + 1) * kb_effect.period_ms);
+     schedule_delayed_work(&kb_effect_work,
+                           msecs_to_jiffies(max_t(s64, ktime_ms_delta(next, ktime_get()), 0)));
+ out:
+     mutex_unlock(&kb_effect_lock);
  }
  
- static acpi_status battery_health_set(u8 function, u8 function_status){
+ static void kb_keyframes_stop(void)
+ {
+     mutex_lock(&kb_effect_lock);
+     kb_effect.running = false;
+     mutex_unlock(&kb_effect_lock);
+     cancel_delayed_work_sync(&kb_effect_work);
+ }
  
-     pr_info("battery_health_set: %d | %d\n",function,function_status);
-     
-     acpi_status status;
-     union acpi_object *obj;
-     struct set_battery_health_control_input params = {
-         .uBatteryNo = 0x1,
-         .uFunctionMask = function,
-         .uFunctionStatus = function_status,
-         .uReservedIn = { 0x0, 0x0, 0x0, 0x0, 0x0 }
-     };
-     struct set_battery_health_control_output  ret;
+ static int kb_effect_parse_keyframe(char *str, struct kb_keyframe *kf)
+ {
+     char *token;
+     int i;
  
-     struct acpi_buffer input = {
-         sizeof(struct set_battery_health_control_input), &params
-     };
+     token = strsep(&str, ":");
+     if (!str || kstrtouint(token, 10, &kf->duration_ms) || !kf->duration_ms ||
+         kf->duration_ms > 60 * MSEC_PER_SEC)
+         return -EINVAL;
  
-     struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
+     for (i = 0; i < 4; i++) {
+         token = strsep(&str, ",");
+         if (!token || strlen(token) != 6 || kstrtou32(token, 16, &kf->color[i]))
+             return -EINVAL;
+     }
  
-     status = wmi_evaluate_method(WMID_GUID5, 0, ACER_WMID_SET_BATTERY_HEALTH_CONTROL_METHODID, &input, &output);
-     if (ACPI_FAILURE(status))
-         return status;
-     
-     obj = output.pointer;
+     if (!str || kstrtoint(str, 10, &kf->brightness) || kf->brightness < 0 || kf->brightness > 100)
+         return -EINVAL;
  
-       if (!obj || obj->type != ACPI_TYPE_BUFFER || obj->buffer.length != 4) {
-         pr_err("Unexpected output format getting battery health status, buffer "
-                "length:%d\n",
-                obj->buffer.length);
-         goto failed;
-       }
-     
-       ret = *((struct set_battery_health_control_output  *)obj->buffer.pointer);
-     
-     if(ret.uReturn != 0 && ret.uReservedOut != 0){
-         pr_err("Failed to set battery health status\n");
-         goto failed;
-     }
+     return 0;
+ }
  
-     kfree(obj);
-     return AE_OK;
+ static ssize_t kb_effect_show(struct device *dev, struct device_attribute *attr, char *buf)
+ {
+     ssize_t len;
  
-     failed:
-           kfree(obj);
-           return AE_ERROR;
+     mutex_lock(&kb_effect_lock);
+     len = sysfs_emit(buf, "%s keyframes=%d fps=%u achieved_fps=%u frames=%llu writes=%llu dropped=%llu\n",
+                      kb_effect.running ? "running" : "stopped", kb_effect.nr, kb_effect_fps,
+                      kb_effect.running ? kb_effect.achieved_fps : 0,
+                      kb_effect.frames, kb_effect.writes, kb_effect.dropped);
+     mutex_unlock(&kb_effect_lock);
+ 
+     return len;
  }
  
+ static ssize_t kb_effect_store(struct device *dev, struct device_attribute *attr,
+                                const char *buf, size_t count)
+ {
+     struct kb_keyframe kf[KB_EFFECT_MAX_KEYFRAMES];
+     char *str, *cur, *token;
+     u32 cycle_ms = 0;
+     int nr = 0, err = 0;
  
- static ssize_t predator_battery_limit_show(struct device *dev,
-                                            struct device_attribute *attr,
-                                            char *buf) {
+     if (sysfs_streq(buf, "stop")) {
+         four_zone_effect_stop();
+         return count;
+     }
  
-     int enabled;
-     acpi_status status = battery_health_query(HEALTH_MODE, &enabled);
+     str = kstrndup(buf, count, GFP_KERNEL);
+     if (!str)
+         return -ENOMEM;
  
-     if (ACPI_FAILURE(status))
-         return -ENODEV;
+     cur = strim(str);
+     while ((token = strsep(&cur, ";")) && !err) {
+         token = strim(token);
+         if (!*token)
+             continue;
+         if (nr == KB_EFFECT_MAX_KEYFRAMES)
+             err = -E2BIG;
+         else
+             err = kb_effect_parse_keyframe(token, &kf[nr]);
+         if (!err)
+             cycle_ms += kf[nr++].duration_ms;
+     }
+     kfree(str);
+     if (err)
+         return err;
+     if (!nr)
+         return -EINVAL;
  
-     return sprintf(buf, "%d\n", enabled);
+     four_zone_effect_stop();
+ 
+     mutex_lock(&kb_effect_lock);
+     memcpy(kb_effect.kf, kf, nr * sizeof(kf[0]));
+     kb_effect.nr = nr;
+     kb_effect.cycle_ms = cycle_ms;
+     kb_effect.period_ms = MSEC_PER_SEC / kb_effect_fps;
+     kb_effect.start = ktime_get();
+     kb_effect.window_start = kb_effect.start;
+     kb_effect.window_frames = 0;
+     kb_effect.achieved_fps = 0;
+     kb_effect.last_tick = 0;
+     kb_effect.frames = 0;
+     kb_effect.writes = 0;
+     kb_effect.dropped = 0;
+     kb_effect.running = true;
+     schedule_delayed_work(&kb_effect_work, 0);
+     mutex_unlock(&kb_effect_lock);
+ 
+     return count;
  }
  
- static ssize_t predator_battery_limit_store(struct device *dev,
-                                             struct device_attribute *attr,
-                                             const char *buf, size_t count) {
-     u8 val;
-       if (sscanf(buf, "%hhd", &val) != 1)
-         return -EINVAL;
+ static ssize_t kb_effect_fps_show(struct device *dev, struct device_attribute *attr, char *buf)
+ {
+     return sprintf(buf, "%u\n", READ_ONCE(kb_effect_fps));
+ }
  
-       if ((val != 0) && (val != 1))
+ static ssize_t kb_effect_fps_store(struct device *dev, struct device_attribute *attr,
+                                    const char *buf, size_t count)
+ {
+     unsigned int fps;
+     int err;
+ 
+     err = kstrtouint(buf, 10, &fps);
+     if (err)
+         return err;
+     if (!fps || fps > KB_EFFECT_MAX_FPS)
          return -EINVAL;
-       
-     if (battery_health_set(HEALTH_MODE,val) != AE_OK)
-         return -ENODEV;
-       
+ 
+     /* Applies from the next effect */
+     WRITE_ONCE(kb_effect_fps, fps);
      return count;
  }
  
- static ssize_t predator_battery_calibration_show(struct device *dev,
-                                            struct device_attribute *attr,
-                                            char *buf) {
+ /*
+  * Binary frames, for software that computes its own animation (e.g. audio
+  * reactive lighting) and would otherwise format and parse per_zone_mode
+  * strings for every frame.
+  *
+  * frame takes a single struct kb_frame and writes it right away. frames
+  * takes an array of struct kb_timed_frame, each shown delay_ms after the
+  * previous one (the first one delay_ms after the write, or after the last
+  * queued frame if frames are still pending). Up to KB_FRAME_QUEUE_LEN frames
+  * can be pending. Writing frame, per_zone_mode, four_zone_mode or effect
+  * drops the pending frames.
+  */
+ struct kb_frame {
+     u8 zone[4][3];      /* red, green, blue for zones 1 to 4 */
+     u8 brightness;      /* 0 to 100 */
+ } __packed;
  
-     int enabled;
-     acpi_status status = battery_health_query(CALIBRATION_MODE, &enabled);
+ struct kb_timed_frame {
+     __le16 delay_ms;
+     struct kb_frame frame;
+ } __packed;
  
-     if (ACPI_FAILURE(status))
-         return -ENODEV;
+ #define KB_FRAME_QUEUE_LEN 64
  
-     return sprintf(buf, "%d\n", enabled);
- }
+ static struct {
+     struct kb_timed_frame q[KB_FRAME_QUEUE_LEN];
+     unsigned int head;
+     unsigned int len;
+     ktime_t due;
+ } kb_frame_queue;
  
- static ssize_t preadtor_battery_calibration_store(struct device *dev,
-                                             struct device_attribute *attr,
-                                             const char *buf, size_t count) {
-     u8 val;
-       if (sscanf(buf, "%hhd", &val) != 1)
-         return -EINVAL;
-       
-     if ((val != 0) && (val != 1))
+ static DEFINE_MUTEX(kb_frame_lock);
+ 
+ static void kb_frame_queue_fn(struct work_struct *work);
+ static DECLARE_DELAYED_WORK(kb_frame_work, kb_frame_queue_fn);
+ 
+ static int kb_frame_to_zones(const struct kb_frame *frame, struct per_zone_color *zones)
+ {
+     u64 *out[] = { &zones->zone1, &zones->zone2, &zones->zone3, &zones->zone4 };
+ 
+     if (frame->brightness > 100)
          return -EINVAL;
-       
-     if (battery_health_set(CALIBRATION_MODE,val) != AE_OK)
-         return -ENODEV;
-       
-     return count;
+ 
+     for (int i = 0; i < 4; i++)
+         *out[i] = frame->zone[i][0] << 16 | frame->zone[i][1] << 8 | frame->zone[i][2];
+     zones->brightness = frame->brightness;
+     return 0;
  }
  
+ /* Schedule the frame at the head of the queue, kb_frame_lock held */
+ static void kb_frame_queue_arm(void)
+ {
+     s64 delay_ms;
+ 
+     kb_frame_queue.due = ktime_add_ms(kb_frame_queue.due,
+                                       le16_to_cpu(kb_frame_queue.q[kb_frame_queue.head].delay_ms));
+     delay_ms = ktime_ms_delta(kb_frame_queue.due, ktime_get());
+     schedule_delayed_work(&kb_frame_work, msecs_to_jiffies(max_t(s64, delay_ms, 0)));
+ }
+ 
+ static void kb_frame_queue_fn(struct work_struct *work)
+ {
+     struct per_zone_color zones;
+     acpi_status status;
+ 
+     mutex_lock(&kb_frame_lock);
+     if (!kb_frame_queue.len)
+         goto out;
+ 
+     /* Frames were checked when queued */
+     kb_frame_to_zones(&kb_frame_queue.q[kb_frame_queue.head].frame, &zones);
+     kb_frame_queue.head = (kb_frame_queue.head + 1) % KB_FRAME_QUEUE_LEN;
+     kb_frame_queue.len--;
+ 
+     status = four_zone_kb_write_zones(&zones);
+     if (ACPI_FAILURE(status)) {
+         pr_err("Error setting RGB KB status, dropping queued frames.\n");
+         kb_frame_queue.len = 0;
+         goto out;
+     }
+ 
+     if (kb_frame_queue.len)
+         kb_frame_queue_arm();
+ out:
+     mutex_unlock(&kb_frame_lock);
+ }
+ 
+ static void kb_frame_queue_stop(void)
+ {
+     mutex_lock(&kb_frame_lock);
+     kb_frame_queue.len = 0;
+     mutex_unlock(&kb_frame_lock);
+     cancel_delayed_work_sync(&kb_frame_work);
+ }
  
  /*
-  * FAN CONTROLS
+  * Temperature mode: the zones show a hwmon temperature channel as a bar,
+  * lit from zone 1 upwards as it rises, in a color fading from cold to hot.
+  * The temperature is sampled every KB_TEMP_INTERVAL_MS and quantized to
+  * KB_TEMP_LEVELS levels; the keyboard is only written when the level
+  * changes, so a steady temperature costs no firmware writes.
+  *
+  * temp_mode takes "<channel>,<min C>,<max C>,<cold RRGGBB>,<hot RRGGBB>,<brightness>"
+  * or "off".
   */
- static int cpu_fan_speed = 0;
- static int gpu_fan_speed = 0;
+ #define KB_TEMP_LEVELS      16
+ #define KB_TEMP_INTERVAL_MS 1000
+ 
+ static struct {
+     bool running;
+     int channel;
+     int min_c, max_c;
+     u32 cold, hot;
+     int brightness;
+     int level;          /* level on the keyboard, -1 before the first write */
+     u64 writes;
+ } kb_temp;
  
- static u64 fan_val_calc(int percentage, int fan_index) {
-     return (((percentage * 25600) / 100) & 0xFF00) + fan_index;
+ static DEFINE_MUTEX(kb_temp_lock);
+ 
+ static void kb_temp_fn(struct work_struct *work);
+ static DECLARE_DELAYED_WORK(kb_temp_work, kb_temp_fn);
+ 
+ /* kb_temp_lock held */
+ static int kb_temp_level(long temp_c)
+ {
+     long level = DIV_ROUND_CLOSEST((temp_c - kb_temp.min_c) * (KB_TEMP_LEVELS - 1),
+                                    kb_temp.max_c - kb_temp.min_c);
+ 
+     return clamp_val(level, 0, KB_TEMP_LEVELS - 1);
+ }
+ 
+ /* kb_temp_lock held */
+ static void kb_temp_render(int level, struct per_zone_color *frame)
+ {
+     u64 *zones[] = { &frame->zone1, &frame->zone2, &frame->zone3, &frame->zone4 };
+     u32 color = kb_effect_lerp_rgb(kb_temp.cold, kb_temp.hot, level, KB_TEMP_LEVELS - 1);
+ 
+     /* Zone 1 is always lit, each following zone adds a quarter of the range */
+     for (int z = 0; z < 4; z++)
+         *zones[z] = level * 4 >= z * (KB_TEMP_LEVELS - 1) ? color : 0;
+     frame->brightness = kb_temp.brightness;
  }
- static acpi_status acer_set_fan_speed(int t_cpu_fan_speed, int t_gpu_fan_speed){
-     
-     acpi_status status;
  
-     if (t_cpu_fan_speed == 100 && t_gpu_fan_speed == 100) {
-         pr_info("MAX FAN MODE!\n");
-         status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0x820009, NULL);
-         if(ACPI_FAILURE(status)){
-             pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
-             return AE_ERROR;
-         }
-     } else if (t_cpu_fan_speed == 0 && t_gpu_fan_speed == 0) {
-         pr_info("AUTO FAN MODE!\n");
-         status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0x410009, NULL);
-         if(ACPI_FAILURE(status)){
-             pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
-             return AE_ERROR;
-         }
-     } else if (t_cpu_fan_speed <= 100 && t_gpu_fan_speed <= 100) {
-         if (t_cpu_fan_speed == 0) {
-             pr_info("CUSTOM FAN MODE (GPU)\n");
-             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0x10001, NULL);
-             if(ACPI_FAILURE(status)){
-                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
-                 return AE_ERROR;
-             }
-             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0xC00008, NULL);
-             if(ACPI_FAILURE(status)){
-                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
-                 return AE_ERROR;
-             }
-             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_SPEED_METHODID, fan_val_calc(t_gpu_fan_speed,4), NULL);
-             if(ACPI_FAILURE(status)){
-                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
-                 return AE_ERROR;
-             }
-         } else if (t_gpu_fan_speed == 0) {
-             pr_info("CUSTOM FAN MODE (CPU)\n");
-             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0x400008, NULL);
-             if(ACPI_FAILURE(status)){
-                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
-                 return AE_ERROR;
-             }
-             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0x30001, NULL);
-             if(ACPI_FAILURE(status)){
-                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
-                 return AE_ERROR;
-             }
-             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_SPEED_METHODID, fan_val_calc(t_cpu_fan_speed,1), NULL);
-             if(ACPI_FAILURE(status)){
-                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
-                 return AE_ERROR;
-             }
-         } else {
-             pr_info("CUSTOM FAN MODE (MIXED)!\n");
-             //set gaming behvaiour mode to custom
-             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_BEHAVIOR_METHODID, 0xC30009, NULL);
-             if(ACPI_FAILURE(status)){
-                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
-                 return AE_ERROR;
-             }
-             //set cpu fan speed
-             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_SPEED_METHODID, fan_val_calc(t_cpu_fan_speed,1), NULL);
-             if(ACPI_FAILURE(status)){
-                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
-                 return AE_ERROR;
-             }
-             //set gpu fan speed
-             status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_FAN_SPEED_METHODID, fan_val_calc(t_gpu_fan_speed,4), NULL);
-             if(ACPI_FAILURE(status)){
-                 pr_err("Error setting fan speed status: %s\n",acpi_format_exception(status));
-                 return AE_ERROR;
+ static void kb_temp_fn(struct work_struct *work)
+ {
+     struct per_zone_color frame;
+     long temp;
+     int level;
+ 
+     mutex_lock(&kb_temp_lock);
+     if (!kb_temp.running)
+         goto out;
+ 
+     if (!acer_wmi_temp_read(kb_temp.channel, &temp)) {
+         level = kb_temp_level(temp);
+         if (level != kb_temp.level) {
+             kb_temp_render(level, &frame);
+             if (ACPI_SUCCESS(four_zone_kb_write_zones(&frame))) {
+                 kb_temp.level = level;
+                 kb_temp.writes++;
              }
          }
-     } else {
-         return AE_ERROR;
      }
  
-     cpu_fan_speed = t_cpu_fan_speed;
-     gpu_fan_speed = t_gpu_fan_speed;
-     pr_info("Fan speeds updated: CPU=%d, GPU=%d\n", cpu_fan_speed, gpu_fan_speed);
- 
-     return AE_OK;	
+     schedule_delayed_work(&kb_temp_work, msecs_to_jiffies(KB_TEMP_INTERVAL_MS));
+ out:
+     mutex_unlock(&kb_temp_lock);
  }
  
- static ssize_t predator_fan_speed_show(struct device *dev,
-                                            struct device_attribute *attr,
-                                            char *buf) {
-   return sprintf(buf, "%d,%d\n", cpu_fan_speed, gpu_fan_speed);                           
+ static void kb_temp_stop(void)
+ {
+     mutex_lock(&kb_temp_lock);
+     kb_temp.running = false;
+     mutex_unlock(&kb_temp_lock);
+     cancel_delayed_work_sync(&kb_temp_work);
  }
  
+ static ssize_t kb_temp_show(struct device *dev, struct device_attribute *attr, char *buf)
+ {
+     ssize_t len;
  
- static ssize_t predator_fan_speed_store(struct device *dev,
-                                             struct device_attribute *attr,
-                                             const char *buf, size_t count) {
-     int t_cpu_fan_speed, t_gpu_fan_speed;
-     
-     char input[9];
-     char *token;
-     char* input_ptr = input;
-     size_t len = min(count, sizeof(input) - 1);
-     strncpy(input, buf, len);
+     mutex_lock(&kb_temp_lock);
+     if (!kb_temp.running)
+         len = sysfs_emit(buf, "off\n");
+     else
+         len = sysfs_emit(buf, "%d,%d,%d,%06x,%06x,%d level=%d/%d writes=%llu\n",
+                          kb_temp.channel, kb_temp.min_c, kb_temp.max_c, kb_temp.cold,
+                          kb_temp.hot, kb_temp.brightness, kb_temp.level, KB_TEMP_LEVELS - 1,
+                          kb_temp.writes);
+     mutex_unlock(&kb_temp_lock);
  
-     if(input[len-1] == '\n'){
-         input[len-1] = '\0';
-     } else {
-         input[len] = '\0';
+     return len;
+ }
+ 
+ static ssize_t kb_temp_store(struct device *dev, struct device_attribute *attr,
+                              const char *buf, size_t count)
+ {
+     int channel, min_c, max_c, brightness;
+     char str_buf[48], *input_ptr = str_buf, *token;
+     u32 cold, hot;
+     long temp;
+     int err;
+ 
+     if (sysfs_streq(buf, "off")) {
+         kb_temp_stop();
+         return count;
      }
  
+     strscpy(str_buf, buf, sizeof(str_buf));
+     input_ptr = strim(str_buf);
  
      token = strsep(&input_ptr, ",");
-     if (!token || kstrtoint(token, 10, &t_cpu_fan_speed) || t_cpu_fan_speed < 0 || t_cpu_fan_speed > 100) {
-         pr_err("Invalid CPU speed value.\n");
+     if (!token || kstrtoint(token, 10, &channel))
          return -EINVAL;
-     }
- 
      token = strsep(&input_ptr, ",");
-     if (!token || kstrtoint(token, 10, &t_gpu_fan_speed) || t_gpu_fan_speed < 0 || t_gpu_fan_speed > 100) {
-         pr_err("Invalid GPU speed value.\n");
+     if (!token || kstrtoint(token, 10, &min_c) || min_c < -40 || min_c > 150)
+         return -EINVAL;
+     token = strsep(&input_ptr, ",");
+     if (!token || kstrtoint(token, 10, &max_c) || max_c <= min_c || max_c > 150)
+         return -EINVAL;
+     token = strsep(&input_ptr, ",");
+     if (!token || strlen(token) != 6 || kstrtou32(token, 16, &cold))
+         return -EINVAL;
+     token = strsep(&input_ptr, ",");
+     if (!token || strlen(token) != 6 || kstrtou32(token, 16, &hot))
+         return -EINVAL;
+     if (!input_ptr || kstrtoint(input_ptr, 10, &brightness) || brightness < 0 || brightness > 100)
          return -EINVAL;
-     }
  
-     acpi_status status = acer_set_fan_speed(t_cpu_fan_speed, t_gpu_fan_speed);
-     if(ACPI_FAILURE(status)){
-         return -ENODEV;
-     } 
+     /* Make sure the sensor can be read before taking the keyboard over */
+     err = acer_wmi_temp_read(channel, &temp);
+     if (err)
+         return err;
+ 
+     four_zone_effect_stop();
+ 
+     mutex_lock(&kb_temp_lock);
+     kb_temp.channel = channel;
+     kb_temp.min_c = min_c;
+     kb_temp.max_c = max_c;
+     kb_temp.cold = cold;
+     kb_temp.hot = hot;
+     kb_temp.brightness = brightness;
+     kb_temp.level = -1;
+     kb_temp.writes = 0;
+     kb_temp.running = true;
+     schedule_delayed_work(&kb_temp_work, 0);
+     mutex_unlock(&kb_temp_lock);
  
      return count;
  }
+ 
+ static void four_zone_effect_stop(void)
+ {
+     kb_keyframes_stop();
+     kb_frame_queue_stop();
+     kb_temp_stop();
+ }
+ 
+ static bool four_zone_effect_active(void)
+ {
+     return READ_ONCE(kb_effect.running) || READ_ONCE(kb_temp.running) ||
+            READ_ONCE(kb_frame_queue.len);
+ }
+ 
  /*
-  * persistent predator states.
+  * Idle timeout. With idle_timeout set, the backlight fades out after that
+  * many seconds without a key press and comes back as it was on the next
+  * one. Key presses only record a timestamp, kb_idle_work checks it when the
+  * timeout could have run out. Effects keep the keyboard lit.
   */
- struct acer_predator_state {
-     int cpu_fan_speed;
-     int gpu_fan_speed;
-     int thermal_profile;
- };
+ #define KB_IDLE_FADE_STEPS   10
+ #define KB_IDLE_FADE_STEP_MS 100
+ #define KB_IDLE_MAX_TIMEOUT  3600
  
- struct power_states {
-     struct acer_predator_state battery_state;
-     struct acer_predator_state ac_state;
- } __attribute__((packed));
+ static DEFINE_MUTEX(kb_idle_lock);
  
- static struct power_states current_states = {
-     .battery_state = {0, 0, ACER_PREDATOR_V4_THERMAL_PROFILE_ECO},
-     .ac_state = {0, 0, ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED}
- };
+ static void kb_idle_fn(struct work_struct *work)
+ {
+     unsigned long timeout = READ_ONCE(kb_idle.timeout) * HZ;
+     unsigned long idle_for, next = 0;
+     struct kb_state kb;
  
- static int acer_predator_state_update(int value){
-     u8 current_tp;
-     int tp, err;
-     err = WMID_gaming_get_misc_setting(
-        ACER_WMID_MISC_SETTING_PLATFORM_PROFILE, 
-        &current_tp);
-     if (err)
-         return err;
-     switch (current_tp) {
-         case ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO:
-             tp = ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO;
-             break;
-         case ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE:
-             tp = ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE;
-             break;
-         case ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED:
-             tp = ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED;
-             break;
-         case ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET:
-             tp = ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET;
+     if (!timeout)
+         return;
+ 
+     mutex_lock(&kb_state_lock);
+     idle_for = jiffies - READ_ONCE(kb_idle.last_input);
+     switch (kb_idle.phase) {
+     case KB_IDLE_ACTIVE:
+         if (idle_for < timeout) {
+             next = timeout - idle_for;
              break;
-         case ACER_PREDATOR_V4_THERMAL_PROFILE_ECO:
-             tp = ACER_PREDATOR_V4_THERMAL_PROFILE_ECO;
+         }
+         /* The state to come back to must be known */
+         if (four_zone_effect_active() || !current_kb_state_valid) {
+             next = timeout;
              break;
-         default:
-             return -1;
-     }
-     /* When AC is connected */
-     if(value == 1){
-         current_states.ac_state.thermal_profile = tp;
-         current_states.ac_state.cpu_fan_speed = cpu_fan_speed;
-         current_states.ac_state.gpu_fan_speed = gpu_fan_speed;
-     /* When AC isn't connected */
-     } else if(value == 0){
-         current_states.battery_state.thermal_profile = tp;
-         current_states.battery_state.cpu_fan_speed = cpu_fan_speed;
-         current_states.battery_state.gpu_fan_speed = gpu_fan_speed;
-     } else {
-         pr_err("invalid value received: %d\n", value);
-         return -1;
+         }
+         kb_idle.saved = current_kb_state;
+         kb_idle.step = 0;
+         WRITE_ONCE(kb_idle.phase, KB_IDLE_FADING);
+         fallthrough;
+     case KB_IDLE_FADING:
+         kb = kb_idle.saved;
+         kb_idle.step++;
+         kb.brightness = kb.brightness * (KB_IDLE_FADE_STEPS - kb_idle.step) / KB_IDLE_FADE_STEPS;
+         kb.zones.brightness = kb.brightness;
+         if (ACPI_FAILURE(__four_zone_kb_apply(&kb))) {
+             pr_err("Failed to fade keyboard backlight\n");
+             WRITE_ONCE(kb_idle.phase, KB_IDLE_ACTIVE);
+             next = timeout;
+         } else if (kb_idle.step == KB_IDLE_FADE_STEPS) {
+             /* Off until the next key press */
+             WRITE_ONCE(kb_idle.phase, KB_IDLE_OFF);
+         } else {
+             next = msecs_to_jiffies(KB_IDLE_FADE_STEP_MS);
+         }
+         break;
+     case KB_IDLE_OFF:
+         break;
      }
-     return 0;
+     mutex_unlock(&kb_state_lock);
+ 
+     if (next)
+         schedule_delayed_work(&kb_idle_work, next);
  }
  
- static acpi_status acer_predator_state_restore(int value){
-     int err = WMID_gaming_set_misc_setting(ACER_WMID_MISC_SETTING_PLATFORM_PROFILE, 
-                                        value == 0 ? current_states.battery_state.thermal_profile : current_states.ac_state.thermal_profile);
-     if (err)
-         return err;
+ /* Bring the backlight back as it was before the fade */
+ static void kb_idle_restore(void)
+ {
+     mutex_lock(&kb_state_lock);
+     if (kb_idle.phase != KB_IDLE_ACTIVE) {
+         WRITE_ONCE(kb_idle.phase, KB_IDLE_ACTIVE);
+         if (ACPI_FAILURE(__four_zone_kb_apply(&kb_idle.saved)))
+             pr_err("Failed to restore keyboard backlight\n");
+     }
+     mutex_unlock(&kb_state_lock);
+ }
  
-     acpi_status status = acer_set_fan_speed(value == 0 ? current_states.battery_state.cpu_fan_speed : current_states.ac_state.cpu_fan_speed, 
-                                 value == 0 ? current_states.battery_state.gpu_fan_speed : current_states.ac_state.gpu_fan_speed);
-     if(ACPI_FAILURE(status)){
-         return AE_ERROR;
-     } 
+ static void kb_idle_wake_fn(struct work_struct *work)
+ {
+     unsigned int timeout = READ_ONCE(kb_idle.timeout);
  
-     return AE_OK;
+     kb_idle_restore();
+     if (timeout)
+         mod_delayed_work(system_wq, &kb_idle_work, timeout * HZ);
  }
  
- static int acer_predator_state_load(void)
+ static DECLARE_WORK(kb_idle_wake_work, kb_idle_wake_fn);
+ 
+ static void kb_idle_event(struct input_handle *handle, unsigned int type,
+                           unsigned int code, int value)
  {
-     u64 on_AC;
-     struct file *file;
-     ssize_t len;
-     acpi_status status;
+     if (type != EV_KEY)
+         return;
  
-     file = filp_open(STATE_FILE, O_RDONLY, 0);
-     if (!IS_ERR(file)) {
+     WRITE_ONCE(kb_idle.last_input, jiffies);
+     if (READ_ONCE(kb_idle.phase) != KB_IDLE_ACTIVE)
+         schedule_work(&kb_idle_wake_work);
+ }
  
-         len = kernel_read(file, (char *)&current_states, sizeof(current_states), &file->f_pos);
-         filp_close(file, NULL);
+ static int kb_idle_connect(struct input_handler *handler, struct input_dev *dev,
+                            const struct input_device_id *id)
+ {
+     struct input_handle *handle;
+     int err;
  
-         if (len != sizeof(current_states)) {
-             pr_err("Incomplete state read, using defaults\n");
-         } else {
-             pr_info("Thermal states loaded\n");
-         }
-     } else {
-         pr_info("State file not found, loading defaults\n");
-     }
+     handle = kzalloc(sizeof(*handle), GFP_KERNEL);
+     if (!handle)
+         return -ENOMEM;
  
-     /* Always proceed to restore state based on power source */
-     status = WMI_gaming_execute_u64(
-         ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
-         ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS, &on_AC);
+     handle->dev = dev;
+     handle->handler = handler;
+     handle->name = "acer-wmi-idle";
  
-     if (ACPI_FAILURE(status)) {
-         pr_err("Failed to query power source state\n");
-         return -1;
-     }
+     err = input_register_handle(handle);
+     if (err)
+         goto err_free;
  
-     /* Restore state based on power source (0 for battery, 1 for AC) */
-     status = acer_predator_state_restore(on_AC == 0 ? 0 : 1);
-     if (ACPI_FAILURE(status)) {
-         pr_err("Failed to restore thermal state\n");
-         return -1;
-     }
+     err = input_open_device(handle);
+     if (err)
+         goto err_unregister;
  
-     pr_info("Thermal states restored successfully\n");
      return 0;
+ 
+ err_unregister:
+     input_unregister_handle(handle);
+ err_free:
+     kfree(handle);
+     return err;
  }
  
+ static void kb_idle_disconnect(struct input_handle *handle)
+ {
+     input_close_device(handle);
+     input_unregister_handle(handle);
+     kfree(handle);
+ }
  
- static int acer_predator_state_save(void){
-     u64 on_AC;
-     acpi_status status;
-     struct file *file;
-     ssize_t len;
+ static const struct input_device_id kb_idle_ids[] = {
+     {
+         .flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+         .evbit = { BIT_MASK(EV_KEY) },
+     },
+     { }
+ };
  
-     status = WMI_gaming_execute_u64(
-         ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
-         ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS, &on_AC);
-     if (ACPI_FAILURE(status))
-         return -1;
+ static struct input_handler kb_idle_handler = {
+     .event = kb_idle_event,
+     .connect = kb_idle_connect,
+     .disconnect = kb_idle_disconnect,
+     .name = "acer-wmi-idle",
+     .id_table = kb_idle_ids,
+ };
+ 
+ /* Stop watching input and light the keyboard back up, kb_idle_lock held */
+ static void __kb_idle_disable(void)
+ {
+     WRITE_ONCE(kb_idle.timeout, 0);
+     if (kb_idle.registered) {
+         input_unregister_handler(&kb_idle_handler);
+         kb_idle.registered = false;
+     }
+     cancel_delayed_work_sync(&kb_idle_work);
+     cancel_work_sync(&kb_idle_wake_work);
+     kb_idle_restore();
+ }
+ 
+ static void kb_idle_disable(void)
+ {
+     mutex_lock(&kb_idle_lock);
+     __kb_idle_disable();
+     mutex_unlock(&kb_idle_lock);
+ }
+ 
+ static ssize_t kb_idle_timeout_show(struct device *dev, struct device_attribute *attr, char *buf)
+ {
+     return sprintf(buf, "%u\n", READ_ONCE(kb_idle.timeout));
+ }
  
-     /* update to the latest state based on power source */
-     status = acer_predator_state_update(on_AC == 0 ? 0 : 1);
-     if (ACPI_FAILURE(status)){
-         return -1;
-     }
+ static ssize_t kb_idle_timeout_store(struct device *dev, struct device_attribute *attr,
+                                      const char *buf, size_t count)
+ {
+     unsigned int timeout;
+     int err;
  
-     file = filp_open(STATE_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-     if(!file) {
-         pr_info("state_access - Error opening file\n");
-         return -1;
-     }
+     err = kstrtouint(buf, 10, &timeout);
+     if (err)
+         return err;
+     if (timeout > KB_IDLE_MAX_TIMEOUT)
+         return -EINVAL;
  
-     len = kernel_write(file, (char *)&current_states, sizeof(current_states), &file->f_pos);
-     if(len < 0) {
-         pr_info("state_access - Error writing to file: %ld\n", len);
-         filp_close(file, NULL);
+     mutex_lock(&kb_idle_lock);
+     if (!timeout) {
+         __kb_idle_disable();
+         goto out;
      }
  
-     filp_close(file, NULL);
- 
-     if (len != sizeof(current_states)) {
-         pr_err("Failed to write complete state to file\n");
-         return -1;
+     if (!kb_idle.registered) {
+         err = input_register_handler(&kb_idle_handler);
+         if (err)
+             goto out;
+         kb_idle.registered = true;
      }
+     WRITE_ONCE(kb_idle.last_input, jiffies);
+     WRITE_ONCE(kb_idle.timeout, timeout);
+     mod_delayed_work(system_wq, &kb_idle_work, timeout * HZ);
+ out:
+     mutex_unlock(&kb_idle_lock);
+     return err ? err : count;
+ }
  
-     pr_info("Thermal states saved successfully\n");
-     return 0;
+ #ifdef CONFIG_PM_SLEEP
+ /* Suspend stops the timer and lights the keyboard so it is saved and restored lit */
+ static void kb_idle_suspend(void)
+ {
+     cancel_delayed_work_sync(&kb_idle_work);
+     cancel_work_sync(&kb_idle_wake_work);
+     kb_idle_restore();
  }
  
- /*
-  *LCD OVERRIDE CONTROLS
-  */
- static ssize_t predator_lcd_override_show(struct device *dev, struct device_attribute *attr,char *buf){
-     acpi_status status;
-     u64 result;
-     status = WMI_gaming_execute_u64(ACER_WMID_GET_GAMING_PROFILE_METHODID,0x00,&result);
-     if(ACPI_FAILURE(status)){
-         pr_err("Error getting lcd override status: %s\n",acpi_format_exception(status));
-         return -ENODEV;
-     }
-     pr_info("lcd override get status: %llu\n",result);
-     return sprintf(buf, "%d\n", result == 0x1000001000000 ? 1 : result == 0x1000000 ? 0 : -1);
+ static void kb_idle_resume(void)
+ {
+     unsigned int timeout = READ_ONCE(kb_idle.timeout);
+ 
+     WRITE_ONCE(kb_idle.last_input, jiffies);
+     if (timeout)
+         schedule_delayed_work(&kb_idle_work, timeout * HZ);
  }
+ #endif
  
- static ssize_t predator_lcd_override_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
-     acpi_status status;
-     u64 result;
-     u8 val;
-       if (sscanf(buf, "%hhd", &val) != 1)
-         return -EINVAL;
-       if ((val != 0) && (val != 1))
+ static ssize_t kb_frame_write(struct file *filp, struct kobject *kobj,
+                               const struct bin_attribute *attr, char *buf,
+                               loff_t off, size_t count)
+ {
+     struct per_zone_color zones;
+     int err;
+ 
+     if (off || count != sizeof(struct kb_frame))
          return -EINVAL;
-     pr_info("lcd_override set value: %d\n",val);
-     status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_PROFILE_METHODID,val == 1 ? 0x1000000000010 : 0x10, &result);
-     if(ACPI_FAILURE(status)){
-         pr_err("Error setting lcd override status: %s\n",acpi_format_exception(status));
-         return -ENODEV;
-     }
-     pr_info("lcd override set status: %llu\n",result);
-     return count;
- }
  
- /*
-  * BACKLIGHT 30 SEC TIMEOUT
-  */
+     err = kb_frame_to_zones((const struct kb_frame *)buf, &zones);
+     if (err)
+         return err;
  
- static ssize_t predator_backlight_timeout_show(struct device *dev, struct device_attribute *attr,char *buf){
-     acpi_status status;
-     u64 result;
-     status = WMI_apgeaction_execute_u64(ACER_WMID_GET_FUNCTION,0x88401,&result);
-     if(ACPI_FAILURE(status)){
-         pr_err("Error getting backlight_timeout status: %s\n",acpi_format_exception(status));
+     four_zone_effect_stop();
+ 
+     if (ACPI_FAILURE(four_zone_kb_write_zones(&zones))) {
+         pr_err("Error setting RGB KB status.\n");
          return -ENODEV;
      }
-     pr_info("backlight_timeout get status: %llu\n",result);
-     return sprintf(buf, "%d\n", result == 0x1E0000080000 ? 1 : result == 0x80000 ? 0 : -1);
+     return count;
  }
  
- static ssize_t predator_backlight_timeout_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
-     acpi_status status;
-     u64 result;
-     u8 val;
-       if (sscanf(buf, "%hhd", &val) != 1)
-         return -EINVAL;
-       if ((val != 0) && (val != 1))
+ static ssize_t kb_frames_write(struct file *filp, struct kobject *kobj,
+                                const struct bin_attribute *attr, char *buf,
+                                loff_t off, size_t count)
+ {
+     const struct kb_timed_frame *frames = (const struct kb_timed_frame *)buf;
+     unsigned int nr = count / sizeof(*frames);
+     struct per_zone_color zones;
+     bool idle;
+     int err;
+ 
+     if (off || !nr || count % sizeof(*frames))
          return -EINVAL;
-     pr_info("bascklight_timeout set value: %d\n",val);
-     status = WMI_apgeaction_execute_u64(ACER_WMID_SET_FUNCTION,val == 1 ? 0x1E0000088402 : 0x88402, &result);
-     if(ACPI_FAILURE(status)){
-         pr_err("Error setting backlight_timeout status: %s\n",acpi_format_exception(status));
-         return -ENODEV;
+ 
+     for (unsigned int i = 0; i < nr; i++) {
+         err = kb_frame_to_zones(&frames[i].frame, &zones);
+         if (err)
+             return err;
      }
-     pr_info("backlight_timeout set status: %llu\n",result);
-     return count;
- }
  
- /*
-  * System Boot Animation & Sound 
-  */
- static ssize_t predator_boot_animation_sound_show(struct device *dev, struct device_attribute *attr,char *buf){
-     acpi_status status;
-     u64 result;
-     status = WMI_gaming_execute_u64(ACER_WMID_GET_GAMING_MISC_SETTING_METHODID,0x6,&result);
-     if(ACPI_FAILURE(status)){
-         pr_err("Error getting boot_animation_sound status: %s\n",acpi_format_exception(status));
-         return -ENODEV;
+     /* The queue replaces any other effect, only queued frames are shown */
+     kb_keyframes_stop();
+     kb_temp_stop();
+ 
+     mutex_lock(&kb_frame_lock);
+     if (kb_frame_queue.len + nr > KB_FRAME_QUEUE_LEN) {
+         mutex_unlock(&kb_frame_lock);
+         return -ENOSPC;
      }
-     pr_info("boot_animation_sound get status: %llu\n",result);
-     return sprintf(buf, "%d\n", result == 0x100 ? 1 : result == 0 ? 0 : -1);
- }
  
- static ssize_t predator_boot_animation_sound_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
-     acpi_status status;
-     u64 result;
-     u8 val;
-       if (sscanf(buf, "%hhd", &val) != 1)
-         return -EINVAL;
-       if ((val != 0) && (val != 1))
-         return -EINVAL;
-     pr_info("boot_animation_sound set value: %d\n",val);
-     status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_MISC_SETTING_METHODID,val == 1 ? 0x106 : 0x6, &result);
-     if(ACPI_FAILURE(status)){
-         pr_err("Error setting boot_animation_sound status: %s\n",acpi_format_exception(status));
-         return -ENODEV;
+     idle = !kb_frame_queue.len;
+     for (unsigned int i = 0; i < nr; i++) {
+         unsigned int tail = (kb_frame_queue.head + kb_frame_queue.len) % KB_FRAME_QUEUE_LEN;
+ 
+         kb_frame_queue.q[tail] = frames[i];
+         kb_frame_queue.len++;
      }
-     pr_info("boot_animation_sound set status: %llu\n",result);
+     if (idle) {
+         kb_frame_queue.due = ktime_get();
+         kb_frame_queue_arm();
+     }
+     mutex_unlock(&kb_frame_lock);
+ 
      return count;
  }
  
- /*
-  * predator sense attributes
-  */
- static struct device_attribute boot_animation_sound = __ATTR(boot_animation_sound, 0644, predator_boot_animation_sound_show, predator_boot_animation_sound_store);
- static struct device_attribute backlight_timeout = __ATTR(backlight_timeout, 0644, predator_backlight_timeout_show, predator_backlight_timeout_store);
- static struct device_attribute usb_charging = __ATTR(usb_charging, 0644, predator_usb_charging_show, predator_usb_charging_store);
- static struct device_attribute battery_calibration = __ATTR(battery_calibration, 0644, predator_battery_calibration_show, preadtor_battery_calibration_store);
- static struct device_attribute battery_limiter = __ATTR(battery_limiter, 0644, predator_battery_limit_show, predator_battery_limit_store);
- static struct device_attribute fan_speed = __ATTR(fan_speed, 0644, predator_fan_speed_show, predator_fan_speed_store);
- static struct device_attribute lcd_override = __ATTR(lcd_override, 0644, predator_lcd_override_show, predator_lcd_override_store);
- static struct attribute *predator_sense_attrs[] = {
-     &lcd_override.attr,
-     &fan_speed.attr,
-     &battery_limiter.attr,
-     &battery_calibration.attr,
-     &usb_charging.attr,
-     &backlight_timeout.attr,
-     &boot_animation_sound.attr,
+ static const struct bin_attribute kb_frame_attr =
+     __BIN_ATTR(frame, 0200, NULL, kb_frame_write, sizeof(struct kb_frame));
+ static const struct bin_attribute kb_frames_attr =
+     __BIN_ATTR(frames, 0200, NULL, kb_frames_write,
+                KB_FRAME_QUEUE_LEN * sizeof(struct kb_timed_frame));
+ 
+ /* Four Zoned Keyboard Attributes */
+ static struct device_attribute four_zoned_rgb_mode = __ATTR(four_zone_mode, 0644, four_zoned_rgb_kb_show, four_zoned_rgb_kb_store);
+ static struct device_attribute per_zoned_rgb_mode = __ATTR(per_zone_mode, 0644, per_zoned_rgb_kb_show, per_zoned_rgb_kb_store);
+ static struct device_attribute kb_effect_attr = __ATTR(effect, 0644, kb_effect_show, kb_effect_store);
+ static struct device_attribute kb_effect_fps_attr = __ATTR(effect_fps, 0644, kb_effect_fps_show, kb_effect_fps_store);
+ static struct device_attribute kb_temp_attr = __ATTR(temp_mode, 0644, kb_temp_show, kb_temp_store);
+ static struct device_attribute kb_idle_timeout_attr = __ATTR(idle_timeout, 0644, kb_idle_timeout_show, kb_idle_timeout_store);
+ static struct attribute *four_zoned_kb_attrs[] = {
+     &four_zoned_rgb_mode.attr,
+     &per_zoned_rgb_mode.attr,
+     &kb_effect_attr.attr,
+     &kb_effect_fps_attr.attr,
+     &kb_temp_attr.attr,
+     &kb_idle_timeout_attr.attr,
      NULL
  };
  
- static struct attribute_group preadtor_sense_attr_group = {
-     .name = "predator_sense", .attrs = predator_sense_attrs
+ static const struct bin_attribute *const four_zoned_kb_bin_attrs[] = {
+     &kb_frame_attr,
+     &kb_frames_attr,
+     NULL
  };
  
- static struct attribute_group nitro_sense_v4_attr_group = {
-     .name = "nitro_sense", .attrs = predator_sense_attrs
+ /* Four Zoned RGB Keyboard */
+ static struct attribute_group four_zoned_kb_attr_group = {
+     .name = "four_zoned_kb", .attrs = four_zoned_kb_attrs,
+     .bin_attrs = four_zoned_kb_bin_attrs
  };
  
- /* nitro sense attributes */
- static struct attribute *nitro_sense_attrs[] = {
-     &fan_speed.attr,
-     &battery_limiter.attr,
-     &battery_calibration.attr,
-     &usb_charging.attr,
-     &backlight_timeout.attr,
-     NULL
- }; 
- static struct attribute_group nitro_sense_attr_group = {
-     .name = "nitro_sense", .attrs = nitro_sense_attrs
+ /*
+  * LED class devices: a multicolor LED per keyboard zone and kbd_backlight for
+  * the brightness shared by all zones. LED callbacks can run in atomic context
+  * (triggers), so they only record the change and a work writes the frame.
+  * Zones changed before the work runs land in a single frame, which
+  * four_zone_kb_write_zones() then reduces to the calls that are needed.
+  */
+ #if IS_REACHABLE(CONFIG_LEDS_CLASS_MULTICOLOR)
+ struct kb_zone_led {
+     struct led_classdev_mc mc;
+     struct mc_subled subled[3];
+     char name[32];
+     int zone;
  };
  
- /* Four Zoned Keyboard  */
+ static struct kb_zone_led kb_zone_leds[4];
+ static struct led_classdev kb_global_led;
+ static bool kb_leds_registered;
  
- struct get_four_zoned_kb_output {
-     u8 gmReturn;
-     u8 gmOutput[15];
- } __packed;
+ static DEFINE_SPINLOCK(kb_led_lock);
+ static u32 kb_led_color[4];
+ static u8 kb_led_pending;           /* zones changed through their LED */
+ static int kb_led_brightness = -1;  /* brightness changed through kbd_backlight */
+ static u8 kb_led_touched;           /* zones, and BIT(4) for kbd_backlight, ever set */
+ static bool kb_leds_seeded;
  
- static acpi_status set_kb_status(int mode, int speed, int brightness,
-                                  int direction, int red, int green, int blue){
-     u64 resp = 0;
-     u8 gmInput[16] = {mode, speed, brightness, 0, direction, red, green, blue, 3, 1, 0, 0, 0, 0, 0, 0};
-     
-     acpi_status status;
-     union acpi_object *obj;
-     struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
-     struct acpi_buffer input = { (acpi_size)sizeof(gmInput), (void *)(gmInput) };
-     
-     status = wmi_evaluate_method(WMID_GUID4, 0, ACER_WMID_SET_GAMING_KB_BACKLIGHT_METHODID, &input, &output);
-     if (ACPI_FAILURE(status))
-         return status;
+ /*
+  * Take the LED state from what the keyboard shows. Reading it costs five WMI
+  * calls, so probe leaves this to the state restore work, which seeds from the
+  * state it has just applied, or to the first LED write. LEDs already set by
+  * the user keep their value.
+  */
+ static void kb_leds_seed(void)
+ {
+     const struct per_zone_color *z;
+     struct kb_state kb;
+     unsigned long flags;
+     u64 zones[4];
+     bool in_zones;
  
-     obj = (union acpi_object *) output.pointer;
+     if (READ_ONCE(kb_leds_seeded) || four_zone_kb_get(&kb))
+         return;
  
-     if (obj) {
-         if (obj->type == ACPI_TYPE_BUFFER) {
-             if (obj->buffer.length == sizeof(u32))
-                 resp = *((u32 *) obj->buffer.pointer);
-             else if (obj->buffer.length == sizeof(u64))
-                 resp = *((u64 *) obj->buffer.pointer);
-         } else if (obj->type == ACPI_TYPE_INTEGER) {
-             resp = (u64) obj->integer.value;
+     /* Zones are unknown under a hardware effect */
+     in_zones = kb.per_zone;
+     z = &kb.zones;
+     zones[0] = in_zones ? z->zone1 : 0;
+     zones[1] = in_zones ? z->zone2 : 0;
+     zones[2] = in_zones ? z->zone3 : 0;
+     zones[3] = in_zones ? z->zone4 : 0;
+ 
+     spin_lock_irqsave(&kb_led_lock, flags);
+     if (!kb_leds_seeded) {
+         for (int i = 0; i < 4; i++) {
+             if (kb_led_touched & BIT(i))
+                 continue;
+             kb_led_color[i] = zones[i];
+             for (int c = 0; c < 3; c++)
+                 kb_zone_leds[i].subled[c].intensity = (zones[i] >> (16 - 8 * c)) & 0xff;
          }
+         if (!(kb_led_touched & BIT(4)))
+             kb_global_led.brightness = kb.brightness;
+         kb_leds_seeded = true;
      }
- 
-     if(resp != 0){
-         pr_err("failed to set keyboard rgb: %llu\n",resp);
-         kfree(obj);
-         return AE_ERROR;
-     }
- 
-     kfree(obj);
-     return status;
- }
- 
- static acpi_status get_kb_status(struct get_four_zoned_kb_output *out){
-     u64 in = 1;
-     acpi_status status;
-     union acpi_object *obj;
-     struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
-     struct acpi_buffer input = { (acpi_size) sizeof(u64), (void *)(&in) };
- 
-     status = wmi_evaluate_method(WMID_GUID4, 0, ACER_WMID_GET_GAMING_KB_BACKLIGHT_METHODID, &input, &output);
-     if (ACPI_FAILURE(status))
-         return status;
-     
-     obj = output.pointer;
- 
-       if (!obj || obj->type != ACPI_TYPE_BUFFER || obj->buffer.length != 16) {
-         pr_err("Unexpected output format getting kb zone status, buffer "
-                "length:%d\n",
-                obj->buffer.length);
-         goto failed;
-       }
- 
-       *out = *((struct get_four_zoned_kb_output  *)obj->buffer.pointer);
- 
-     kfree(obj);
-     return AE_OK;
- 
-     failed:
-           kfree(obj);
-           return AE_ERROR;
+     spin_unlock_irqrestore(&kb_led_lock, flags);
  }
  
- 
- /* KB Backlight State  */;
- 
- struct per_zone_color {
-     u64 zone1, zone2, zone3, zone4;
+ static void kb_led_work_fn(struct work_struct *work)
+ {
+     struct per_zone_color frame = {};
+     u64 *zones[] = { &frame.zone1, &frame.zone2, &frame.zone3, &frame.zone4 };
+     unsigned long flags;
      int brightness;
- } __packed;
+     u32 color[4];
+     bool in_zones;
+     u8 pending;
+ 
+     spin_lock_irqsave(&kb_led_lock, flags);
+     memcpy(color, kb_led_color, sizeof(color));
+     pending = kb_led_pending;
+     brightness = kb_led_brightness;
+     kb_led_pending = 0;
+     kb_led_brightness = -1;
+     spin_unlock_irqrestore(&kb_led_lock, flags);
+ 
+     if (!pending && brightness < 0)
+         return;
  
- struct kb_state {
-     u8 per_zone;
-     u8 mode;
-     u8 speed;
-     u8 brightness;
-     u8 direction;
-     u8 red;
-     u8 green;
-     u8 blue;
-     struct per_zone_color zones;
- } __packed;
+     kb_leds_seed();
  
- static struct kb_state current_kb_state;
+     four_zone_effect_stop();
  
+     mutex_lock(&kb_state_lock);
+     kb_idle_mark_active();
+     /* Zones not changed through their LED keep what the keyboard shows */
+     in_zones = current_kb_state_valid && current_kb_state.per_zone;
+     if (in_zones)
+         frame = current_kb_state.zones;
+     for (int i = 0; i < 4; i++)
+         if (!in_zones || (pending & BIT(i)))
+             *zones[i] = color[i];
  
- /* four zone mode */
- static ssize_t four_zoned_rgb_kb_show(struct device *dev, struct device_attribute *attr,char *buf){
-     acpi_status status;
-     struct get_four_zoned_kb_output output;
-     status = get_kb_status(&output);
-     if(ACPI_FAILURE(status)){
-         pr_err("Error getting kb status: %s\n",acpi_format_exception(status));
-         return -ENODEV;
-     }
-     return sprintf(buf, "%d,%d,%d,%d,%d,%d,%d\n",output.gmOutput[0],output.gmOutput[1],output.gmOutput[2],output.gmOutput[4],output.gmOutput[5],output.gmOutput[6],output.gmOutput[7]);
+     if (brightness < 0)
+         brightness = current_kb_state_valid ? current_kb_state.brightness :
+                      READ_ONCE(kb_global_led.brightness);
+     frame.brightness = brightness;
+ 
+     if (ACPI_FAILURE(__four_zone_kb_write_zones(&frame)))
+         pr_err("Error setting RGB KB status.\n");
+     else
+         acer_state_mark_dirty();
+     mutex_unlock(&kb_state_lock);
  }
  
- static ssize_t four_zoned_rgb_kb_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
-     acpi_status status;
+ static DECLARE_WORK(kb_led_work, kb_led_work_fn);
  
-     int mode, speed, brightness, direction, red, green, blue;
-     char input_buf[30];
-     char *token;
-     char *input_ptr = input_buf;
-     size_t len = min(count, sizeof(input_buf) - 1);
+ static void kb_zone_led_set(struct led_classdev *cdev, enum led_brightness value)
+ {
+     struct led_classdev_mc *mc = lcdev_to_mccdev(cdev);
+     struct kb_zone_led *led = container_of(mc, struct kb_zone_led, mc);
+     unsigned long flags;
  
-     strncpy(input_buf, buf, len);
+     led_mc_calc_color_components(mc, value);
  
-     if(input_buf[len-1] == '\n'){
-         input_buf[len-1] = '\0';
-     } else {
-         input_buf[len] = '\0';
-     }
+     spin_lock_irqsave(&kb_led_lock, flags);
+     kb_led_color[led->zone] = led->subled[0].brightness << 16 |
+                               led->subled[1].brightness << 8 |
+                               led->subled[2].brightness;
+     kb_led_pending |= BIT(led->zone);
+     kb_led_touched |= BIT(led->zone);
+     spin_unlock_irqrestore(&kb_led_lock, flags);
  
-     token = strsep(&input_ptr, ",");
-     if (!token || kstrtoint(token, 10, &mode) || mode < 0 || mode > 7) {
-         pr_err("Invalid mode value.\n");
-         return -EINVAL;
-     }
+     schedule_work(&kb_led_work);
+ }
  
-     token = strsep(&input_ptr, ",");
-     if (!token || kstrtoint(token, 10, &speed) || speed < 0 || speed > 9) {
-         pr_err("Invalid speed value.\n");
-         return -EINVAL;
-     }
+ static void kb_global_led_set(struct led_classdev *cdev, enum led_brightness value)
+ {
+     unsigned long flags;
  
-     token = strsep(&input_ptr, ",");
-     if (!token || kstrtoint(token, 10, &brightness) || brightness < 0 || brightness > 100) {
-         pr_err("Invalid brightness value.\n");
-         return -EINVAL;
-     }
+     spin_lock_irqsave(&kb_led_lock, flags);
+     kb_led_brightness = value;
+     kb_led_touched |= BIT(4);
+     spin_unlock_irqrestore(&kb_led_lock, flags);
  
-     token = strsep(&input_ptr, ",");
-     if (!token || kstrtoint(token, 10, &direction) || ((direction <= 0) && (mode == 0x3 || mode == 0x4 )) || direction < 0 || direction > 2) {
-         pr_err("Invalid direction value.\n");
-         return -EINVAL;
-     }
+     schedule_work(&kb_led_work);
+ }
  
-     token = strsep(&input_ptr, ",");
-     if (!token || kstrtoint(token, 10, &red) || red < 0 || red > 255) {
-         pr_err("Invalid red value.\n");
-         return -EINVAL;
+ static int kb_leds_init(struct device *dev)
+ {
+     static const unsigned int color_ids[] = {
+         LED_COLOR_ID_RED, LED_COLOR_ID_GREEN, LED_COLOR_ID_BLUE
+     };
+     unsigned long flags;
+     int err, i;
+ 
+     /* The colors start out black unless the restore work has seeded them */
+     for (i = 0; i < 4; i++) {
+         struct kb_zone_led *led = &kb_zone_leds[i];
+ 
+         led->zone = i;
+         snprintf(led->name, sizeof(led->name), "acer-wmi:rgb:kbd_zone%d", i + 1);
+         spin_lock_irqsave(&kb_led_lock, flags);
+         for (int c = 0; c < 3; c++) {
+             led->subled[c].color_index = color_ids[c];
+             led->subled[c].intensity = (kb_led_color[i] >> (16 - 8 * c)) & 0xff;
+         }
+         spin_unlock_irqrestore(&kb_led_lock, flags);
+         led->mc.subled_info = led->subled;
+         led->mc.num_colors = 3;
+         led->mc.led_cdev.name = led->name;
+         led->mc.led_cdev.max_brightness = LED_FULL;
+         led->mc.led_cdev.brightness = LED_FULL;
+         led->mc.led_cdev.brightness_set = kb_zone_led_set;
+         /* Leave the keyboard lit when the driver goes away */
+         led->mc.led_cdev.flags = LED_RETAIN_AT_SHUTDOWN;
+ 
+         err = led_classdev_multicolor_register(dev, &led->mc);
+         if (err)
+             goto error;
      }
  
-     token = strsep(&input_ptr, ",");
-     if (!token || kstrtoint(token, 10, &green) || green < 0 || green > 255) {
-         pr_err("Invalid green value.\n");
-         return -EINVAL;
-     }
+     kb_global_led.name = "acer-wmi::kbd_backlight";
+     kb_global_led.max_brightness = 100;
+     kb_global_led.brightness_set = kb_global_led_set;
+     kb_global_led.flags = LED_RETAIN_AT_SHUTDOWN;
+     err = led_classdev_register(dev, &kb_global_led);
+     if (err)
+         goto error;
  
-     token = strsep(&input_ptr, ",");
-     if (!token || kstrtoint(token, 10, &blue) || blue < 0 || blue > 255) {
-         pr_err("Invalid blue value.\n");
-         return -EINVAL;
-     }
+     kb_leds_registered = true;
+     return 0;
  
-     switch (mode) {
-         case 0x0:  // Static mode: Ignore speed and direction
-             speed = 0;
-             direction = 0;
-             break;
-         case 0x1:  // Breathing mode: Ignore speed
-             speed = 0;
-             direction = 0;
-             break;
-         case 0x2:  // Neon mode: Ignore red, green, blue, and direction
-             red = 0;
-             green = 0;
-             blue = 0;
-             direction = 0;
-             break;
-         case 0x3:  // Wave mode: Ignore red, green, and blue
-             red = 0;
-             green = 0;
-             blue = 0;
-             break;
-         case 0x4:  // Shifting mode: No restrictions (all values allowed)
-             break;
-         case 0x5:  // Zoom mode: Ignore direction
-             direction = 0;
-             break;
-         case 0x6:  // Meteor mode: Ignore direction
-             direction = 0;
-             break;
-         case 0x7:  // Twinkling mode: Ignore direction
-             direction = 0;
-             break;
-         default:
-             pr_err("Invalid mode value.\n");
-             return -EINVAL;
-     }
+ error:
+     while (i--)
+         led_classdev_multicolor_unregister(&kb_zone_leds[i].mc);
+     cancel_work_sync(&kb_led_work);
+     return err;
+ }
  
-     status = set_kb_status(mode,speed,brightness,direction,red,green,blue);
-     if (ACPI_FAILURE(status)) {
-         pr_err("Error setting RGB KB status.\n");
-         return -ENODEV;
-     }
+ /* Let LED changes made so far reach the keyboard */
+ static void kb_leds_flush(void)
+ {
+     if (kb_leds_registered)
+         flush_work(&kb_led_work);
+ }
  
-     /* Set per_zone to 0 */
-     current_kb_state.per_zone = 0;
+ static void kb_leds_exit(void)
+ {
+     if (!kb_leds_registered)
+         return;
  
-     return count;
+     led_classdev_unregister(&kb_global_led);
+     for (int i = 3; i >= 0; i--)
+         led_classdev_multicolor_unregister(&kb_zone_leds[i].mc);
+     cancel_work_sync(&kb_led_work);
+     kb_leds_registered = false;
  }
+ #else
+ static inline int kb_leds_init(struct device *dev) { return 0; }
+ static inline void kb_leds_flush(void) { }
+ static inline void kb_leds_seed(void) { }
+ static inline void kb_leds_exit(void) { }
+ #endif
  
+ /*
+  * Keyboard benchmark, in debugfs under acer-wmi/kb_bench. Writing run drives
+  * the keyboard with static mode writes (set_kb_status) and then with per
+  * zone frames that change every zone, at each rate in kb_bench_rates for
+  * step_ms each, while hwmon sensors are read in the background. results
+  * has the achieved frame rate, call latency percentiles and the sensor read
+  * latency next to its idle baseline. The keyboard state is put back
+  * afterwards.
+  *
+  * With simulate set the bench's own calls never reach ACPI: each one takes
+  * sim_latency_us, serialized like AML evaluation is, and the zone workload
+  * still goes through four_zone_kb_plan() so it makes the calls a real frame
+  * would. Nothing else in the driver is affected and the keyboard is not
+  * touched.
+  */
+ #define KB_BENCH_MAX_SAMPLES 2048
  
- /* Per Zone Mode */
+ enum kb_bench_workload {
+     KB_BENCH_STATUS,
+     KB_BENCH_ZONES,
+     KB_BENCH_WORKLOADS,
+ };
  
- static acpi_status get_per_zone_color(struct per_zone_color *output) {
-     acpi_status status;
-     u64 *zones[] = { &output->zone1, &output->zone2, &output->zone3, &output->zone4 };
-     u8 zone_ids[] = { 0x1, 0x2, 0x4, 0x8 };
+ static const char * const kb_bench_workload_names[] = {
+     [KB_BENCH_STATUS] = "status",
+     [KB_BENCH_ZONES] = "zones",
+ };
  
-     for (int i = 0; i < 4; i++) {
-         status = WMI_gaming_execute_u64(ACER_WMID_GET_GAMING_RGB_KB_METHODID, zone_ids[i], zones[i]);
-         if (ACPI_FAILURE(status)) {
-             pr_err("Error getting kb status (zone %d): %s\n", i + 1, acpi_format_exception(status));
-             return status;
-         }
-         *zones[i] = cpu_to_be64(*zones[i]) >> 32;
-     }
+ /* Frames per second, 0 is as fast as the firmware goes */
+ static const unsigned int kb_bench_rates[] = { 10, 20, 30, 60, 120, 0 };
  
-     /* Fetching Brighness Value */
-     struct get_four_zoned_kb_output out;
-     status = get_kb_status(&out);
-     if (ACPI_FAILURE(status)) {
-         pr_err("get kb status failed!");
-         return status;
-     }
-     output->brightness = out.gmOutput[2];
-     
-     return AE_OK;  
+ struct kb_bench_latency {
+     u32 p50, p90, p99, max;
+ };
+ 
+ struct kb_bench_result {
+     unsigned int frames;
+     unsigned int errors;
+     unsigned int fps_x10;
+     struct kb_bench_latency call;
+     struct kb_bench_latency hwmon;
+ };
+ 
+ static struct {
+     bool running;
+     bool done;
+     bool abort;
+     bool simulate;
+     bool simulated;
+     u32 step_ms;
+     struct kb_bench_result res[KB_BENCH_WORKLOADS][ARRAY_SIZE(kb_bench_rates)];
+     struct kb_bench_latency hwmon_idle;
+     u32 *samples;
+     unsigned int nr_samples;
+     u32 *hwmon_samples;
+     unsigned int nr_hwmon_samples;
+     bool hwmon_stop;
+     u32 sim_us;
+     struct per_zone_color sim_last;     /* the simulated keyboard's frame */
+     bool sim_valid;
+ } kb_bench = {
+     .step_ms = 2000,
+     .sim_us = 500,
+ };
+ 
+ static DEFINE_MUTEX(kb_bench_lock);
+ static DEFINE_MUTEX(kb_bench_sim_lock);
+ 
+ /* A simulated firmware call */
+ static void kb_bench_sim_call(void)
+ {
+     mutex_lock(&kb_bench_sim_lock);
+     fsleep(READ_ONCE(kb_bench.sim_us));
+     mutex_unlock(&kb_bench_sim_lock);
  }
  
+ static int kb_bench_cmp(const void *a, const void *b)
+ {
+     u32 x = *(const u32 *)a, y = *(const u32 *)b;
  
+     return x < y ? -1 : x > y;
+ }
  
- static acpi_status set_per_zone_color(struct per_zone_color *input) {
-     acpi_status status;
-     u64 *zones[] = { &input->zone1, &input->zone2, &input->zone3, &input->zone4 };
-     u8 zone_ids[] = { 0x1, 0x2, 0x4, 0x8 };
+ static void kb_bench_percentiles(u32 *samples, unsigned int n, struct kb_bench_latency *lat)
+ {
+     memset(lat, 0, sizeof(*lat));
+     if (!n)
+         return;
  
-     status = set_kb_status(0, 0, input->brightness, 0, 0, 0, 0);
-     if (ACPI_FAILURE(status)) {
-         pr_err("Error setting KB status.\n");
-         return -ENODEV;
-     }
+     sort(samples, n, sizeof(*samples), kb_bench_cmp, NULL);
+     lat->p50 = samples[(n - 1) * 50 / 100];
+     lat->p90 = samples[(n - 1) * 90 / 100];
+     lat->p99 = samples[(n - 1) * 99 / 100];
+     lat->max = samples[n - 1];
+ }
  
-     for (int i = 0; i < 4; i++) {
-         *zones[i] = (cpu_to_be64(*zones[i]) >> 32) | zone_ids[i];
-         status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_RGB_KB_METHODID, *zones[i], NULL);
-         if (ACPI_FAILURE(status)) {
-             pr_err("Error setting KB color (zone %d): %s\n", i + 1, acpi_format_exception(status));
-             return status;
-         }
+ /* Background sensor reads, as hwmon would issue them */
+ static void kb_bench_hwmon_fn(struct work_struct *work)
+ {
+     u64 command = ACER_WMID_CMD_GET_PREDATOR_V4_SENSOR_READING |
+                   FIELD_PREP(ACER_PREDATOR_V4_SENSOR_INDEX_BIT_MASK,
+                              ACER_WMID_SENSOR_CPU_TEMPERATURE);
+     u64 result;
+     ktime_t t;
+ 
+     while (!READ_ONCE(kb_bench.hwmon_stop)) {
+         t = ktime_get();
+         if (kb_bench.simulated)
+             kb_bench_sim_call();
+         else
+             WMID_gaming_get_sys_info(command, &result);
+         if (kb_bench.nr_hwmon_samples < KB_BENCH_MAX_SAMPLES)
+             kb_bench.hwmon_samples[kb_bench.nr_hwmon_samples++] =
+                 ktime_us_delta(ktime_get(), t);
+         msleep(10);
      }
-     /* set per_zone to 1*/
+ }
  
-     current_kb_state.per_zone = 1;
+ static DECLARE_WORK(kb_bench_hwmon_work, kb_bench_hwmon_fn);
  
-     return status;  
+ static void kb_bench_hwmon_start(void)
+ {
+     kb_bench.nr_hwmon_samples = 0;
+     if (!has_cap(ACER_CAP_FAN_SPEED_READ))
+         return;
+     WRITE_ONCE(kb_bench.hwmon_stop, false);
+     queue_work(system_unbound_wq, &kb_bench_hwmon_work);
  }
  
- static ssize_t per_zoned_rgb_kb_show(struct device *dev, struct device_attribute *attr,char *buf){
-     struct per_zone_color output;
+ static void kb_bench_hwmon_stop(struct kb_bench_latency *lat)
+ {
+     WRITE_ONCE(kb_bench.hwmon_stop, true);
+     flush_work(&kb_bench_hwmon_work);
+     kb_bench_percentiles(kb_bench.hwmon_samples, kb_bench.nr_hwmon_samples, lat);
+ }
+ 
+ /* One frame, with new colors every time so nothing can be skipped */
+ static bool kb_bench_frame(enum kb_bench_workload workload, unsigned int n)
+ {
+     struct per_zone_color zones;
+     u8 v = n * 37;
      acpi_status status;
-     status = get_per_zone_color(&output);
-     if(ACPI_FAILURE(status)){
-         return -ENODEV;
+ 
+     if (workload == KB_BENCH_STATUS) {
+         if (kb_bench.simulated) {
+             kb_bench_sim_call();
+             return false;
+         }
+         return ACPI_FAILURE(set_kb_status(0, 0, 100, 0, v, 255 - v, 0));
+     }
+ 
+     zones.zone1 = v << 16;
+     zones.zone2 = (u8)(v + 64) << 8;
+     zones.zone3 = (u8)(v + 128);
+     zones.zone4 = (u8)(v + 192) << 16 | (u8)(v + 192);
+     zones.brightness = 100;
+ 
+     if (kb_bench.simulated) {
+         struct kb_zone_plan plan;
+ 
+         four_zone_kb_plan(&zones, &kb_bench.sim_last, kb_bench.sim_valid, &plan);
+         if (plan.reset)
+             kb_bench_sim_call();
+         for (int i = 0; i < plan.nr; i++)
+             kb_bench_sim_call();
+         kb_bench.sim_last = zones;
+         kb_bench.sim_valid = true;
+         return false;
      }
-     return sprintf(buf,"%06llx,%06llx,%06llx,%06llx,%d\n",output.zone1,output.zone2,output.zone3,output.zone4,output.brightness);
+ 
+     mutex_lock(&kb_state_lock);
+     status = __four_zone_kb_write_zones(&zones);
+     mutex_unlock(&kb_state_lock);
+     return ACPI_FAILURE(status);
  }
  
- static ssize_t per_zoned_rgb_kb_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
-     int i = 0;
-     size_t len;
-     char *token;
-     char str_buf[34];
-     struct per_zone_color colors;
-     char *input_ptr = str_buf;
-     len = min(count, sizeof(str_buf) - 1);
-     strncpy(str_buf, buf, len);
-     if(str_buf[len-1] == '\n'){
-         str_buf[len-1] = '\0';
+ static void kb_bench_step(enum kb_bench_workload workload, unsigned int rate,
+                           struct kb_bench_result *res)
+ {
+     ktime_t start = ktime_get(), end = ktime_add_ms(start, kb_bench.step_ms);
+     ktime_t deadline = start, t;
+     s64 wait_us;
+ 
+     memset(res, 0, sizeof(*res));
+     kb_bench.nr_samples = 0;
+ 
+     /* Each step starts from a full write, as after a mode change */
+     if (kb_bench.simulated) {
+         kb_bench.sim_valid = false;
      } else {
-         str_buf[len] = '\0';
+         mutex_lock(&kb_state_lock);
+         current_kb_state_valid = false;
+         mutex_unlock(&kb_state_lock);
      }
  
-     acpi_status status;
+     kb_bench_hwmon_start();
  
-     /* zone1,zone2,zone3,zone4 */
-     
-     while ((token = strsep(&input_ptr, ",")) && i < 4) {
-         if (strlen(token) != 6) {
-             pr_err("Invalid rgb length: %s (%lu) (must be 3 bytes)\n", token, strlen(token));
-             return -EINVAL;
-         }
-         if (kstrtoull(token, 16, &((u64 *)&colors)[i])) {
-             pr_err("Invalid hex value: %s\n", token);
-             return -EINVAL;
+     while (!READ_ONCE(kb_bench.abort) && ktime_before(ktime_get(), end)) {
+         if (rate) {
+             wait_us = ktime_us_delta(deadline, ktime_get());
+             if (wait_us > 0)
+                 fsleep(wait_us);
+             deadline = ktime_add_ns(deadline, NSEC_PER_SEC / rate);
+         } else {
+             cond_resched();
          }
-         i++;
-     }
  
-     if (!token || kstrtoint(token, 10, &colors.brightness) || colors.brightness < 0 || colors.brightness > 100) {
-         pr_err("Invalid brightness value.\n");
-         return -EINVAL;
+         t = ktime_get();
+         res->errors += kb_bench_frame(workload, res->frames);
+         if (kb_bench.nr_samples < KB_BENCH_MAX_SAMPLES)
+             kb_bench.samples[kb_bench.nr_samples++] = ktime_us_delta(ktime_get(), t);
+         res->frames++;
      }
  
-     /* set per zone colors */
-     status = set_per_zone_color(&colors);
-     if(ACPI_FAILURE(status)){
-         pr_err("Error setting RGB KB status.\n");
-         return -ENODEV;
-     }
-     return count;
+     res->fps_x10 = div_u64((u64)res->frames * 10 * USEC_PER_SEC,
+                            max_t(s64, ktime_us_delta(ktime_get(), start), 1));
+     kb_bench_hwmon_stop(&res->hwmon);
+     kb_bench_percentiles(kb_bench.samples, kb_bench.nr_samples, &res->call);
  }
  
- /* BackLight State */
- 
- static int four_zone_kb_state_update(void) {
-     acpi_status status;
-     struct get_four_zoned_kb_output out;
+ static void kb_bench_fn(struct work_struct *work)
+ {
+     struct kb_state saved;
+     bool have_saved = false;
+     int w, r;
  
-     // Get keyboard status
-     status = get_kb_status(&out);
-     if (ACPI_FAILURE(status)) {
-         pr_err("get kb status failed!");
-         return -1;
+     if (!kb_bench.simulated) {
+         four_zone_effect_stop();
+         kb_leds_flush();
+         have_saved = !four_zone_kb_get(&saved);
      }
  
-     current_kb_state.mode = out.gmOutput[0];
-     current_kb_state.speed = out.gmOutput[1];
-     current_kb_state.brightness = out.gmOutput[2];
-     current_kb_state.direction = out.gmOutput[4]; 
-     current_kb_state.red = out.gmOutput[5];
-     current_kb_state.green = out.gmOutput[6];
-     current_kb_state.blue = out.gmOutput[7];
+     /* Sensor read latency with the keyboard idle */
+     kb_bench_hwmon_start();
+     msleep(min_t(u32, kb_bench.step_ms, 1000));
+     kb_bench_hwmon_stop(&kb_bench.hwmon_idle);
  
-     // Get per-zone color data
-     status = get_per_zone_color(&current_kb_state.zones);
-     if (ACPI_FAILURE(status)) {
-         pr_err("get_per_zone_color failed!");
-         return -1;
+     for (w = 0; w < KB_BENCH_WORKLOADS; w++)
+         for (r = 0; r < ARRAY_SIZE(kb_bench_rates); r++)
+             kb_bench_step(w, kb_bench_rates[r], &kb_bench.res[w][r]);
+ 
+     /* Put the keyboard back the way it was */
+     if (!kb_bench.simulated) {
+         mutex_lock(&kb_state_lock);
+         current_kb_state_valid = false;
+         mutex_unlock(&kb_state_lock);
+         if (have_saved && ACPI_FAILURE(four_zone_kb_apply(&saved)))
+             pr_err("Failed to restore keyboard state after benchmark\n");
      }
-     return 0;
+ 
+     kvfree(kb_bench.samples);
+     kvfree(kb_bench.hwmon_samples);
+ 
+     mutex_lock(&kb_bench_lock);
+     kb_bench.done = !READ_ONCE(kb_bench.abort);
+     kb_bench.running = false;
+     mutex_unlock(&kb_bench_lock);
  }
  
- static int four_zone_kb_state_save(void){
-     struct file *file;
-     ssize_t len;
-     
-     four_zone_kb_state_update();
+ static DECLARE_WORK(kb_bench_work, kb_bench_fn);
  
-     file = filp_open(KB_STATE_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-     if(!file) {
-         pr_err("kb_state_access - Error opening file\n");
-         return -1;
-     }
+ static ssize_t kb_bench_run_write(struct file *file, const char __user *buf,
+                                   size_t count, loff_t *ppos)
+ {
+     int err = 0;
  
-     len = kernel_write(file, (char *)&current_kb_state, sizeof(current_kb_state), &file->f_pos);
-     if(len < 0) {
-         pr_err("kb_state_access - Error writing to file: %ld\n", len);
-         filp_close(file, NULL);
+     mutex_lock(&kb_bench_lock);
+     if (kb_bench.running) {
+         err = -EBUSY;
+         goto out;
+     }
+     if (!kb_bench.step_ms || kb_bench.step_ms > 60 * MSEC_PER_SEC) {
+         err = -EINVAL;
+         goto out;
      }
-     
-     filp_close(file, NULL);
  
-     if (len != sizeof(current_kb_state)) {
-         pr_err("Failed to write complete state to file\n");
-         return -1;
+     kb_bench.samples = kvcalloc(KB_BENCH_MAX_SAMPLES, sizeof(u32), GFP_KERNEL);
+     kb_bench.hwmon_samples = kvcalloc(KB_BENCH_MAX_SAMPLES, sizeof(u32), GFP_KERNEL);
+     if (!kb_bench.samples || !kb_bench.hwmon_samples) {
+         kvfree(kb_bench.samples);
+         kvfree(kb_bench.hwmon_samples);
+         err = -ENOMEM;
+         goto out;
      }
  
-     pr_info("kb states saved successfully\n");
-     return 0;
+     kb_bench.simulated = kb_bench.simulate;
+     kb_bench.abort = false;
+     kb_bench.done = false;
+     kb_bench.running = true;
+     queue_work(system_long_wq, &kb_bench_work);
+ out:
+     mutex_unlock(&kb_bench_lock);
+     return err ? err : count;
  }
  
+ static const struct file_operations kb_bench_run_fops = {
+     .write = kb_bench_run_write,
+     .llseek = noop_llseek,
+ };
  
- static int four_zone_kb_state_load(void)
+ static void kb_bench_show_latency(struct seq_file *m, const struct kb_bench_latency *lat)
  {
-     struct file *file;
-     ssize_t len;
-     acpi_status status;
- 
-     file = filp_open(KB_STATE_FILE, O_RDONLY, 0);
-     if (!IS_ERR(file)) {
+     seq_printf(m, " %6u %6u %6u %6u", lat->p50, lat->p90, lat->p99, lat->max);
+ }
  
-         len = kernel_read(file, (char *)&current_kb_state, sizeof(current_kb_state), &file->f_pos);
-         filp_close(file, NULL);
+ static int kb_bench_results_show(struct seq_file *m, void *v)
+ {
+     int w, r;
  
-         if (len != sizeof(current_kb_state)) {
-             pr_err("Incomplete state read\n");
-             return -1;
-         } else {
-             pr_info("KB states loaded\n");
-         }
-     } else {
-         pr_info("KB state file not found!\n");
-         return -1;
+     mutex_lock(&kb_bench_lock);
+     if (kb_bench.running) {
+         seq_puts(m, "running\n");
+         goto out;
+     }
+     if (!kb_bench.done) {
+         seq_puts(m, "no results\n");
+         goto out;
      }
  
-     if(current_kb_state.per_zone){
-         status = set_per_zone_color(&current_kb_state.zones);
-         if(ACPI_FAILURE(status)){
-             pr_err("Error setting RGB KB status.\n");
-             return -1;
-         }
-     } else {
-         status = set_kb_status(current_kb_state.mode,current_kb_state.speed,current_kb_state.brightness,current_kb_state.direction,current_kb_state.red,current_kb_state.green,current_kb_state.blue);
-         if(ACPI_FAILURE(status)){
-             pr_err("Error setting KB status.\n");
-             return -1;
+     seq_printf(m, "firmware: %s\n", kb_bench.simulated ? "simulated" : "real");
+     seq_puts(m, "latencies in us:            call p50    p90    p99    max  hwmon p50    p90    p99    max\n");
+     seq_printf(m, "%-8s %5s %6s %6s %6s", "idle", "-", "-", "-", "-");
+     seq_printf(m, " %6s %6s %6s %6s", "-", "-", "-", "-");
+     kb_bench_show_latency(m, &kb_bench.hwmon_idle);
+     seq_putc(m, '\n');
+ 
+     for (w = 0; w < KB_BENCH_WORKLOADS; w++) {
+         for (r = 0; r < ARRAY_SIZE(kb_bench_rates); r++) {
+             const struct kb_bench_result *res = &kb_bench.res[w][r];
+ 
+             seq_printf(m, "%-8s %5u %6u %4u.%u %6u", kb_bench_workload_names[w],
+                        kb_bench_rates[r], res->frames, res->fps_x10 / 10,
+                        res->fps_x10 % 10, res->errors);
+             kb_bench_show_latency(m, &res->call);
+             kb_bench_show_latency(m, &res->hwmon);
+             seq_putc(m, '\n');
          }
      }
- 
-     pr_info("KB states restored successfully\n");
+     seq_puts(m, "(columns: workload, target fps (0 = unpaced), frames, achieved fps, errors)\n");
+ out:
+     mutex_unlock(&kb_bench_lock);
      return 0;
  }
+ DEFINE_SHOW_ATTRIBUTE(kb_bench_results);
  
- /* Four Zoned Keyboard Attributes */
- static struct device_attribute four_zoned_rgb_mode = __ATTR(four_zone_mode, 0644, four_zoned_rgb_kb_show, four_zoned_rgb_kb_store);
- static struct device_attribute per_zoned_rgb_mode = __ATTR(per_zone_mode, 0644, per_zoned_rgb_kb_show, per_zoned_rgb_kb_store);
- static struct attribute *four_zoned_kb_attrs[] = {
-     &four_zoned_rgb_mode.attr,
-     &per_zoned_rgb_mode.attr,
-     NULL
- };
+ static void kb_bench_debugfs_init(struct dentry *parent)
+ {
+     struct dentry *dir = debugfs_create_dir("kb_bench", parent);
  
- /* Four Zoned RGB Keyboard */
- static struct attribute_group four_zoned_kb_attr_group = {
-     .name = "four_zoned_kb", .attrs = four_zoned_kb_attrs
- };
+     debugfs_create_file("run", 0200, dir, NULL, &kb_bench_run_fops);
+     debugfs_create_file("results", 0444, dir, NULL, &kb_bench_results_fops);
+     debugfs_create_bool("simulate", 0644, dir, &kb_bench.simulate);
+     debugfs_create_u32("sim_latency_us", 0644, dir, &kb_bench.sim_us);
+     debugfs_create_u32("step_ms", 0644, dir, &kb_bench.step_ms);
+ }
+ 
+ static void kb_bench_stop(void)
+ {
+     WRITE_ONCE(kb_bench.abort, true);
+     flush_work(&kb_bench_work);
+ }
  /*
   * Platform device
   */
  
+ /* Stop the profile registration and undo what its ready hook started */
+ static void acer_platform_profile_stop(void)
+ {
+     cancel_delayed_work_sync(&acer_profile_register_work);
+     /* After the registration work, which starts the sampling */
+     cancel_delayed_work_sync(&acer_stats_sample_work);
+     acer_boost_exit();
+     cancel_delayed_work_sync(&acer_profile_resync_work);
+     acer_profile_qos_exit();
+ }
+ 
  static int acer_platform_probe(struct platform_device *device)
  {
      int err;
@@ -4108,13 +7611,13 @@ enum acer_wmi_predator_v4_oc {
          err = sysfs_create_group(&device->dev.kobj, &preadtor_sense_attr_group);
          if (err)
              goto error_predator_sense;
-         acer_predator_state_load();
+         acer_state_restore_start();
      }
      if (has_cap(ACER_CAP_NITRO_SENSE_V4)) {
          err = sysfs_create_group(&device->dev.kobj, &nitro_sense_v4_attr_group);
          if (err)
              goto error_predator_sense;
-         acer_predator_state_load();
+         acer_state_restore_start();
      }
      if (has_cap(ACER_CAP_NITRO_SENSE)){
          err = sysfs_create_group(&device->dev.kobj, &nitro_sense_attr_group);
@@ -4122,11 +7625,26 @@ enum acer_wmi_predator_v4_oc {
              goto error_nitro_sense;
      }
  
+     if (has_cap(ACER_CAP_TURBO_OC)) {
+         err = sysfs_create_group(&device->dev.kobj, &overclock_attr_group);
+         if (err)
+             goto error_overclock;
+     }
+ 
      if(quirks->four_zone_kb){
          err = sysfs_create_group(&device->dev.kobj, &four_zoned_kb_attr_group);
          if (err)
              goto error_four_zone;
-         four_zone_kb_state_load();
+         if (kb_leds_init(&device->dev))
+             pr_warn("Failed to register keyboard zone LEDs\n");
+     }
+ 
+     if (acer_state_has_power() || quirks->four_zone_kb) {
+         err = sysfs_create_bin_file(&device->dev.kobj, &acer_state_blob);
+         if (err)
+             goto error_state_blob;
+         WRITE_ONCE(acer_state_dev, &device->dev);
+         acer_config_fw_request(&device->dev);
      }
  
      if (has_cap(ACER_CAP_FAN_SPEED_READ)) {
@@ -4135,9 +7653,27 @@ enum acer_wmi_predator_v4_oc {
              goto error_hwmon;
      }
  
+     register_reboot_notifier(&acer_reboot_nb);
+ 
      return 0;
  
  error_hwmon:
+     if (acer_state_has_power() || quirks->four_zone_kb) {
+         acer_config_fw_wait();
+         WRITE_ONCE(acer_state_dev, NULL);
+         cancel_delayed_work_sync(&acer_state_writeback_work);
+         sysfs_remove_bin_file(&device->dev.kobj, &acer_state_blob);
+     }
+ error_state_blob:
+     if (quirks->four_zone_kb)
+         kb_leds_exit();
+ error_four_zone:
+ error_overclock:
+ error_nitro_sense:
+ error_predator_sense:
+     cancel_work_sync(&acer_restore_work);
+     /* The registration work may still be pending against this device */
+     acer_platform_profile_stop();
  error_platform_profile:
      acer_rfkill_exit();
  error_rfkill:
@@ -4146,12 +7682,6 @@ enum acer_wmi_predator_v4_oc {
  error_brightness:
      if (has_cap(ACER_CAP_MAILLED))
          acer_led_exit();
- error_four_zone:
-     return err;
- error_nitro_sense:
-     return err;
- error_predator_sense:
-     return err;
  error_mailled:
      return err;
  }
@@ -4159,31 +7689,131 @@ enum acer_wmi_predator_v4_oc {
  
  static void acer_platform_remove(struct platform_device *device)
  {
+     unregister_reboot_notifier(&acer_reboot_nb);
+     acer_config_fw_wait();
+     cancel_work_sync(&acer_restore_work);
+     acer_wmi_hwmon_sample_stop();
+     acer_platform_profile_stop();
      if (has_cap(ACER_CAP_MAILLED))
          acer_led_exit();
      if (has_cap(ACER_CAP_BRIGHTNESS))
          acer_backlight_exit();
-     if (has_cap(ACER_CAP_PREDATOR_SENSE)) {
-         sysfs_remove_group(&device->dev.kobj, &preadtor_sense_attr_group);
-         acer_predator_state_save();
+     if (acer_state_has_power() || quirks->four_zone_kb) {
+         WRITE_ONCE(acer_state_dev, NULL);
+         cancel_delayed_work_sync(&acer_state_writeback_work);
+         sysfs_remove_bin_file(&device->dev.kobj, &acer_state_blob);
      }
-     if (has_cap(ACER_CAP_NITRO_SENSE)) {
+     if (has_cap(ACER_CAP_PREDATOR_SENSE))
+         sysfs_remove_group(&device->dev.kobj, &preadtor_sense_attr_group);
+     if (has_cap(ACER_CAP_NITRO_SENSE))
         sysfs_remove_group(&device->dev.kobj, &nitro_sense_v4_attr_group);
-        acer_predator_state_save();
-     }
-     if (has_cap(ACER_CAP_NITRO_SENSE_V4)) {
+     if (has_cap(ACER_CAP_NITRO_SENSE_V4))
          sysfs_remove_group(&device->dev.kobj, &nitro_sense_v4_attr_group);
-         acer_predator_state_save();
-     }
-     if(quirks->four_zone_kb){
+     if (has_cap(ACER_CAP_TURBO_OC))
+         sysfs_remove_group(&device->dev.kobj, &overclock_attr_group);
+     if(quirks->four_zone_kb) {
          sysfs_remove_group(&device->dev.kobj, &four_zoned_kb_attr_group);
-         four_zone_kb_state_save();
+         kb_bench_stop();
+         kb_idle_disable();
+         kb_leds_exit();
+         four_zone_effect_stop();
      }
  
      acer_rfkill_exit();
  }
  
+ /* Cost of the last resume restore, in debugfs */
+ static u64 acer_resume_restore_us;
+ 
  #ifdef CONFIG_PM_SLEEP
+ /*
+  * Gaming state captured at suspend. The firmware may drop custom fan speeds,
+  * the thermal profile and keyboard lighting while asleep, so they are put
+  * back on resume in one go, skipping what the firmware still holds.
+  */
+ static struct {
+     bool valid;
+     int tp;
+     int cpu_fan_speed;
+     int gpu_fan_speed;
+     bool has_kb;
+     struct kb_state kb;
+ } acer_suspend_snapshot;
+ 
+ static void acer_gaming_state_snapshot(void)
+ {
+     u8 tp;
+ 
+     acer_suspend_snapshot.valid = false;
+     if (!platform_profile_support && !quirks->four_zone_kb)
+         return;
+ 
+     acer_suspend_snapshot.tp = acer_thermal_profile_read(&tp) ? -1 : tp;
+     acer_suspend_snapshot.cpu_fan_speed = cpu_fan_speed;
+     acer_suspend_snapshot.gpu_fan_speed = gpu_fan_speed;
+     acer_suspend_snapshot.has_kb = quirks->four_zone_kb &&
+                                    !four_zone_kb_get(&acer_suspend_snapshot.kb);
+     acer_suspend_snapshot.valid = true;
+ }
+ 
+ static void acer_gaming_state_resume(void)
+ {
+     struct acer_gaming_txn txn = ACER_GAMING_TXN("resume");
+     struct kb_state fw_kb;
+     ktime_t start;
+     u64 on_AC;
+     u8 tp;
+ 
+     if (!acer_suspend_snapshot.valid)
+         return;
+     acer_state_restore_wait();
+     start = ktime_get();
+ 
+     if (platform_profile_support && acer_suspend_snapshot.tp >= 0 &&
+         (WMID_gaming_get_misc_setting(ACER_WMID_MISC_SETTING_PLATFORM_PROFILE, &tp) ||
+          tp != acer_suspend_snapshot.tp)) {
+         /* The power source may have changed while asleep, no high profiles on battery */
+         if (ACPI_FAILURE(WMI_gaming_execute_u64(ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
+                                                 ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS, &on_AC)))
+             pr_err("Failed to query power source state on resume\n");
+         else if (!on_AC && acer_suspend_snapshot.tp != ACER_PREDATOR_V4_THERMAL_PROFILE_ECO &&
+                  acer_suspend_snapshot.tp != ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED)
+             pr_info("On battery, not restoring thermal profile %d\n", acer_suspend_snapshot.tp);
+         else
+             acer_txn_add_profile(&txn, acer_suspend_snapshot.tp);
+     }
+ 
+     /*
+      * There is no read back for the fan speed, auto is what the firmware
+      * comes back with so only custom speeds are written again.
+      */
+     if (acer_suspend_snapshot.cpu_fan_speed || acer_suspend_snapshot.gpu_fan_speed) {
+         mutex_lock(&acer_gaming_lock);
+         cpu_fan_speed = 0;
+         gpu_fan_speed = 0;
+         mutex_unlock(&acer_gaming_lock);
+         acer_txn_add_fan_speed(&txn, acer_suspend_snapshot.cpu_fan_speed,
+                                acer_suspend_snapshot.gpu_fan_speed);
+     }
+ 
+     if (acer_txn_commit(&txn))
+         pr_err("Failed to restore thermal state on resume\n");
+ 
+     if (acer_suspend_snapshot.has_kb) {
+         four_zone_effect_stop();
+         fw_kb = acer_suspend_snapshot.kb;
+         if (four_zone_kb_read(&fw_kb) ||
+             !four_zone_kb_state_matches(&acer_suspend_snapshot.kb, &fw_kb)) {
+             if (ACPI_FAILURE(four_zone_kb_apply(&acer_suspend_snapshot.kb)))
+                 pr_err("Failed to restore keyboard state on resume\n");
+         }
+     }
+ 
+     acer_resume_restore_us = ktime_us_delta(ktime_get(), start);
+     pr_debug("resume restore took %llu us (%d firmware writes)\n",
+              acer_resume_restore_us, txn.nr_ops);
+ }
+ 
  static int acer_suspend(struct device *dev)
  {
      u32 value;
@@ -4203,6 +7833,17 @@ enum acer_wmi_predator_v4_oc {
          data->brightness = value;
      }
  
+     if (quirks->four_zone_kb) {
+         kb_bench_stop();
+         four_zone_effect_stop();
+         kb_leds_flush();
+         /* Last, the writes above re-arm the idle timer */
+         kb_idle_suspend();
+     }
+     acer_wmi_hwmon_sample_stop();
+     cancel_delayed_work_sync(&acer_stats_sample_work);
+     acer_gaming_state_snapshot();
+ 
      return 0;
  }
  
@@ -4222,6 +7863,23 @@ enum acer_wmi_predator_v4_oc {
      if (acer_wmi_accel_dev)
          acer_gsensor_init();
  
+     /* The firmware may have reset the thermal profile while asleep */
+     mutex_lock(&acer_gaming_lock);
+     acer_cached_tp = -1;
+     acer_turbo_led_state = -1;
+     acer_fan_mode_state = -1;
+     mutex_unlock(&acer_gaming_lock);
+     /* and the power source may have changed */
+     acer_on_ac = -1;
+     acer_gaming_state_resume();
+     if (quirks->four_zone_kb)
+         kb_idle_resume();
+     if (supported_sensors)
+         acer_wmi_hwmon_sample_start();
+     if (acer_stats_sampling)
+         schedule_delayed_work(&acer_stats_sample_work,
+                               round_jiffies_relative(stats_sample_interval * HZ));
+ 
      return 0;
  }
  #else
@@ -4265,18 +7923,89 @@ enum acer_wmi_predator_v4_oc {
  
      debugfs_create_u32("devices", S_IRUGO, interface->debug.root,
                 &interface->debug.wmid_devices);
+     debugfs_create_u64("txn_count", S_IRUGO, interface->debug.root,
+                &acer_txn_stats.count);
+     debugfs_create_u64("txn_rollbacks", S_IRUGO, interface->debug.root,
+                &acer_txn_stats.rollbacks);
+     debugfs_create_u64("txn_last_us", S_IRUGO, interface->debug.root,
+                &acer_txn_stats.last_us);
+     debugfs_create_u64("txn_max_us", S_IRUGO, interface->debug.root,
+                &acer_txn_stats.max_us);
+     debugfs_create_u64("restore_us", S_IRUGO, interface->debug.root,
+                &acer_restore_us);
+     debugfs_create_u64("resume_restore_us", S_IRUGO, interface->debug.root,
+                &acer_resume_restore_us);
+     if (quirks->four_zone_kb) {
+         debugfs_create_file("kb_resync", 0200, interface->debug.root, NULL,
+                             &four_zone_kb_resync_fops);
+         kb_bench_debugfs_init(interface->debug.root);
+     }
+     acer_stats_debugfs_init(interface->debug.root);
  }
 
- static const enum acer_wmi_predator_v4_sensor_id acer_wmi_temp_channel_to_sensor_id[] = {
-    [0] = ACER_WMID_SENSOR_CPU_TEMPERATURE,
-    [1] = ACER_WMID_SENSOR_GPU_TEMPERATURE,
-    [2] = ACER_WMID_SENSOR_EXTERNAL_TEMPERATURE_2,
-};
-
-static const enum acer_wmi_predator_v4_sensor_id acer_wmi_fan_channel_to_sensor_id[] = {
-    [0] = ACER_WMID_SENSOR_CPU_FAN_SPEED,
-    [1] = ACER_WMID_SENSOR_GPU_FAN_SPEED,
-};
+ /*
+  * hwmon channels, built at init from every bit of the firmware's supported
+  * sensors mask. The sensors the driver knows keep fixed channels, so temp1
+  * is always the CPU. The firmware reads every id through the same call but
+  * does not report its type, so any other id is appended as a temperature
+  * channel labelled "sensor<id>".
+  */
+ #define ACER_WMI_MAX_SENSORS 16
+ 
+ static enum acer_wmi_predator_v4_sensor_id acer_wmi_temp_channel_to_sensor_id[ACER_WMI_MAX_SENSORS] = {
+     [0] = ACER_WMID_SENSOR_CPU_TEMPERATURE,
+     [1] = ACER_WMID_SENSOR_GPU_TEMPERATURE,
+     [2] = ACER_WMID_SENSOR_EXTERNAL_TEMPERATURE_2,
+ };
+ 
+ static enum acer_wmi_predator_v4_sensor_id acer_wmi_fan_channel_to_sensor_id[ACER_WMI_MAX_SENSORS] = {
+     [0] = ACER_WMID_SENSOR_CPU_FAN_SPEED,
+     [1] = ACER_WMID_SENSOR_GPU_FAN_SPEED,
+ };
+ 
+ static const char *acer_wmi_temp_labels[ACER_WMI_MAX_SENSORS] = {
+     [0] = "CPU",
+     [1] = "GPU",
+     [2] = "System",
+ };
+ 
+ static const char *acer_wmi_fan_labels[ACER_WMI_MAX_SENSORS] = {
+     [0] = "CPU",
+     [1] = "GPU",
+ };
+ 
+ /* Known channels, the unknown sensors are counted in by acer_wmi_hwmon_add_sensors() */
+ static int acer_wmi_temp_channels = 3;
+ static int acer_wmi_fan_channels = 2;
+ 
+ /*
+  * Highest and lowest values seen since the last reset_history, in hwmon
+  * units. They are updated on every read, including the background sampler
+  * which reads all channels every update_interval ms (1 s by default) so
+  * short spikes between userspace polls are not missed. Every sample is a
+  * round of WMI calls, so 0 turns it off for users who care about power.
+  */
+ struct acer_wmi_sensor_history {
+     long highest;
+     long lowest;
+     bool valid;
+ };
+ 
+ static struct acer_wmi_sensor_history acer_wmi_temp_history[ACER_WMI_MAX_SENSORS];
+ static struct acer_wmi_sensor_history acer_wmi_fan_history[ACER_WMI_MAX_SENSORS];
+ static DEFINE_SPINLOCK(acer_wmi_history_lock);
+ 
+ #define ACER_WMI_HWMON_MIN_INTERVAL 100
+ #define ACER_WMI_HWMON_MAX_INTERVAL 60000
+ 
+ /*
+  * The hwmon device is devm managed, so update_interval stays writable until
+  * after remove() and the reboot notifier have cancelled the sampler. The
+  * stopping flag, taken under the lock by the write, keeps it from being
+  * armed again until resume.
+  */
+ static DEFINE_SPINLOCK(acer_wmi_hwmon_sample_lock);
+ static bool acer_wmi_hwmon_stopping;
  
  static umode_t acer_wmi_hwmon_is_visible(const void *data,
                       enum hwmon_sensor_types type, u32 attr,
@@ -4286,6 +8015,8 @@ static const enum acer_wmi_predator_v4_sensor_id acer_wmi_fan_channel_to_sensor_
      const u64 *supported_sensors = data;
  
      switch (type) {
+     case hwmon_chip:
+         return attr == hwmon_chip_update_interval ? 0644 : 0200;
      case hwmon_temp:
          sensor_id = acer_wmi_temp_channel_to_sensor_id[channel];
          break;
@@ -4296,61 +8027,269 @@ static const enum acer_wmi_predator_v4_sensor_id acer_wmi_fan_channel_to_sensor_
          return 0;
      }
  
-     if (*supported_sensors & BIT(sensor_id - 1))
-         return 0444;
+     if (!(*supported_sensors & BIT(sensor_id - 1)))
+         return 0;
+ 
+     if (type == hwmon_temp && attr == hwmon_temp_reset_history)
+         return 0200;
+     return 0444;
+ }
+ 
+ /* Temperature of a hwmon temp channel, in degrees C */
+ static int acer_wmi_temp_read(int channel, long *temp)
+ {
+     u64 command = ACER_WMID_CMD_GET_PREDATOR_V4_SENSOR_READING;
+     enum acer_wmi_predator_v4_sensor_id sensor_id;
+     u64 result;
+     int ret;
+ 
+     if (channel < 0 || channel >= acer_wmi_temp_channels)
+         return -EINVAL;
+ 
+     sensor_id = acer_wmi_temp_channel_to_sensor_id[channel];
+     if (!(supported_sensors & BIT(sensor_id - 1)))
+         return -EOPNOTSUPP;
+ 
+     command |= FIELD_PREP(ACER_PREDATOR_V4_SENSOR_INDEX_BIT_MASK, sensor_id);
+     ret = WMID_gaming_get_sys_info(command, &result);
+     if (ret < 0)
+         return ret;
  
+     *temp = FIELD_GET(ACER_PREDATOR_V4_SENSOR_READING_BIT_MASK, result);
      return 0;
  }
  
- static int acer_wmi_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
-                    u32 attr, int channel, long *val)
+ /* Speed of a hwmon fan channel, in RPM */
+ static int acer_wmi_fan_read(int channel, long *rpm)
  {
      u64 command = ACER_WMID_CMD_GET_PREDATOR_V4_SENSOR_READING;
+     enum acer_wmi_predator_v4_sensor_id sensor_id;
      u64 result;
      int ret;
  
+     if (channel < 0 || channel >= acer_wmi_fan_channels)
+         return -EINVAL;
+ 
+     sensor_id = acer_wmi_fan_channel_to_sensor_id[channel];
+     if (!(supported_sensors & BIT(sensor_id - 1)))
+         return -EOPNOTSUPP;
+ 
+     command |= FIELD_PREP(ACER_PREDATOR_V4_SENSOR_INDEX_BIT_MASK, sensor_id);
+     ret = WMID_gaming_get_sys_info(command, &result);
+     if (ret < 0)
+         return ret;
+ 
+     *rpm = FIELD_GET(ACER_PREDATOR_V4_SENSOR_READING_BIT_MASK, result);
+     return 0;
+ }
+ 
+ static void acer_wmi_history_update(struct acer_wmi_sensor_history *h, long val)
+ {
+     spin_lock(&acer_wmi_history_lock);
+     if (!h->valid || val > h->highest)
+         h->highest = val;
+     if (!h->valid || val < h->lowest)
+         h->lowest = val;
+     h->valid = true;
+     spin_unlock(&acer_wmi_history_lock);
+ }
+ 
+ static int acer_wmi_history_read(const struct acer_wmi_sensor_history *h, bool highest, long *val)
+ {
+     int ret = 0;
+ 
+     spin_lock(&acer_wmi_history_lock);
+     if (h->valid)
+         *val = highest ? h->highest : h->lowest;
+     else
+         ret = -ENODATA;
+     spin_unlock(&acer_wmi_history_lock);
+ 
+     return ret;
+ }
+ 
+ static void acer_wmi_history_reset(struct acer_wmi_sensor_history *h, int n)
+ {
+     spin_lock(&acer_wmi_history_lock);
+     for (int i = 0; i < n; i++)
+         h[i].valid = false;
+     spin_unlock(&acer_wmi_history_lock);
+ }
+ 
+ /* Current value of a channel, which also feeds its history */
+ static int acer_wmi_hwmon_read_input(enum hwmon_sensor_types type, int channel, long *val)
+ {
+     long temp;
+     int ret;
+ 
      switch (type) {
      case hwmon_temp:
-         command |= FIELD_PREP(ACER_PREDATOR_V4_SENSOR_INDEX_BIT_MASK,
-                       acer_wmi_temp_channel_to_sensor_id[channel]);
- 
-         ret = WMID_gaming_get_sys_info(command, &result);
+         ret = acer_wmi_temp_read(channel, &temp);
          if (ret < 0)
              return ret;
  
-         result = FIELD_GET(ACER_PREDATOR_V4_SENSOR_READING_BIT_MASK, result);
-         *val = result * MILLIDEGREE_PER_DEGREE;
+         *val = temp * MILLIDEGREE_PER_DEGREE;
+         acer_wmi_history_update(&acer_wmi_temp_history[channel], *val);
          return 0;
      case hwmon_fan:
-         command |= FIELD_PREP(ACER_PREDATOR_V4_SENSOR_INDEX_BIT_MASK,
-                       acer_wmi_fan_channel_to_sensor_id[channel]);
- 
-         ret = WMID_gaming_get_sys_info(command, &result);
+         ret = acer_wmi_fan_read(channel, val);
          if (ret < 0)
              return ret;
  
-         *val = FIELD_GET(ACER_PREDATOR_V4_SENSOR_READING_BIT_MASK, result);
+         acer_wmi_history_update(&acer_wmi_fan_history[channel], *val);
+         return 0;
+     default:
+         return -EOPNOTSUPP;
+     }
+ }
+ 
+ static int acer_wmi_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
+                    u32 attr, int channel, long *val)
+ {
+     switch (type) {
+     case hwmon_chip:
+         if (attr != hwmon_chip_update_interval)
+             return -EOPNOTSUPP;
+         *val = READ_ONCE(acer_wmi_hwmon_interval);
+         return 0;
+     case hwmon_temp:
+         switch (attr) {
+         case hwmon_temp_input:
+             return acer_wmi_hwmon_read_input(type, channel, val);
+         case hwmon_temp_highest:
+         case hwmon_temp_lowest:
+             return acer_wmi_history_read(&acer_wmi_temp_history[channel],
+                                          attr == hwmon_temp_highest, val);
+         default:
+             return -EOPNOTSUPP;
+         }
+     case hwmon_fan:
+         switch (attr) {
+         case hwmon_fan_input:
+             return acer_wmi_hwmon_read_input(type, channel, val);
+         case hwmon_fan_max:
+             return acer_wmi_history_read(&acer_wmi_fan_history[channel], true, val);
+         default:
+             return -EOPNOTSUPP;
+         }
+     default:
+         return -EOPNOTSUPP;
+     }
+ }
+ 
+ static int acer_wmi_hwmon_write(struct device *dev, enum hwmon_sensor_types type,
+                                 u32 attr, int channel, long val)
+ {
+     switch (type) {
+     case hwmon_chip:
+         if (attr == hwmon_chip_temp_reset_history) {
+             /* The fan peaks have their own fan_reset_history */
+             acer_wmi_history_reset(acer_wmi_temp_history, acer_wmi_temp_channels);
+             return 0;
+         }
+         if (attr != hwmon_chip_update_interval || val < 0)
+             return -EINVAL;
+ 
+         /* 0 stops the background sampler */
+         if (val)
+             val = clamp_val(val, ACER_WMI_HWMON_MIN_INTERVAL, ACER_WMI_HWMON_MAX_INTERVAL);
+         spin_lock(&acer_wmi_hwmon_sample_lock);
+         WRITE_ONCE(acer_wmi_hwmon_interval, val);
+         if (!val)
+             cancel_delayed_work(&acer_wmi_hwmon_sample_work);
+         else if (!acer_wmi_hwmon_stopping)
+             mod_delayed_work(system_wq, &acer_wmi_hwmon_sample_work, msecs_to_jiffies(val));
+         spin_unlock(&acer_wmi_hwmon_sample_lock);
+         return 0;
+     case hwmon_temp:
+         if (attr != hwmon_temp_reset_history)
+             return -EOPNOTSUPP;
+         acer_wmi_history_reset(&acer_wmi_temp_history[channel], 1);
+         return 0;
+     default:
+         return -EOPNOTSUPP;
+     }
+ }
+ 
+ static void acer_wmi_hwmon_sample_start(void)
+ {
+     unsigned long interval;
+ 
+     spin_lock(&acer_wmi_hwmon_sample_lock);
+     acer_wmi_hwmon_stopping = false;
+     interval = acer_wmi_hwmon_interval;
+     if (interval)
+         mod_delayed_work(system_wq, &acer_wmi_hwmon_sample_work, msecs_to_jiffies(interval));
+     spin_unlock(&acer_wmi_hwmon_sample_lock);
+ }
+ 
+ static void acer_wmi_hwmon_sample_stop(void)
+ {
+     spin_lock(&acer_wmi_hwmon_sample_lock);
+     acer_wmi_hwmon_stopping = true;
+     spin_unlock(&acer_wmi_hwmon_sample_lock);
+     cancel_delayed_work_sync(&acer_wmi_hwmon_sample_work);
+ }
+ 
+ static void acer_wmi_hwmon_sample_fn(struct work_struct *work)
+ {
+     unsigned long interval;
+     long val;
+ 
+     for (int i = 0; i < acer_wmi_temp_channels; i++)
+         if (supported_sensors & BIT(acer_wmi_temp_channel_to_sensor_id[i] - 1))
+             acer_wmi_hwmon_read_input(hwmon_temp, i, &val);
+     for (int i = 0; i < acer_wmi_fan_channels; i++)
+         if (supported_sensors & BIT(acer_wmi_fan_channel_to_sensor_id[i] - 1))
+             acer_wmi_hwmon_read_input(hwmon_fan, i, &val);
+ 
+     interval = READ_ONCE(acer_wmi_hwmon_interval);
+     if (interval && !READ_ONCE(acer_wmi_hwmon_stopping))
+         schedule_delayed_work(&acer_wmi_hwmon_sample_work, msecs_to_jiffies(interval));
+ }
+ 
+ static int acer_wmi_hwmon_read_string(struct device *dev, enum hwmon_sensor_types type,
+                                       u32 attr, int channel, const char **str)
+ {
+     switch (type) {
+     case hwmon_temp:
+         *str = acer_wmi_temp_labels[channel];
+         return 0;
+     case hwmon_fan:
+         *str = acer_wmi_fan_labels[channel];
          return 0;
      default:
          return -EOPNOTSUPP;
      }
- } 
+ }
+ 
+ /* Zero terminated, filled in by acer_wmi_hwmon_init() */
+ static u32 acer_wmi_temp_config[ACER_WMI_MAX_SENSORS + 1];
+ static u32 acer_wmi_fan_config[ACER_WMI_MAX_SENSORS + 1];
+ 
+ static const struct hwmon_channel_info acer_wmi_temp_info = {
+     .type = hwmon_temp,
+     .config = acer_wmi_temp_config,
+ };
+ 
+ static const struct hwmon_channel_info acer_wmi_fan_info = {
+     .type = hwmon_fan,
+     .config = acer_wmi_fan_config,
+ };
  
  static const struct hwmon_channel_info *const acer_wmi_hwmon_info[] = {
-     HWMON_CHANNEL_INFO(temp,
-                HWMON_T_INPUT,
-                HWMON_T_INPUT,
-                HWMON_T_INPUT
-                ),
-     HWMON_CHANNEL_INFO(fan,
-                HWMON_F_INPUT,
-                HWMON_F_INPUT
+     HWMON_CHANNEL_INFO(chip,
+                HWMON_C_UPDATE_INTERVAL | HWMON_C_TEMP_RESET_HISTORY
                 ),
+     &acer_wmi_temp_info,
+     &acer_wmi_fan_info,
      NULL
  };
  
  static const struct hwmon_ops acer_wmi_hwmon_ops = {
      .read = acer_wmi_hwmon_read,
+     .read_string = acer_wmi_hwmon_read_string,
+     .write = acer_wmi_hwmon_write,
      .is_visible = acer_wmi_hwmon_is_visible,
  };
  
@@ -4359,6 +8298,77 @@ static const enum acer_wmi_predator_v4_sensor_id acer_wmi_fan_channel_to_sensor_
      .info = acer_wmi_hwmon_info,
  };
  
+ static bool acer_wmi_sensor_known(enum acer_wmi_predator_v4_sensor_id sensor_id)
+ {
+     for (int i = 0; i < acer_wmi_temp_channels; i++)
+         if (acer_wmi_temp_channel_to_sensor_id[i] == sensor_id)
+             return true;
+     for (int i = 0; i < acer_wmi_fan_channels; i++)
+         if (acer_wmi_fan_channel_to_sensor_id[i] == sensor_id)
+             return true;
+     return false;
+ }
+ 
+ /* Add a generic temperature channel for every advertised sensor the driver does not know */
+ static void acer_wmi_hwmon_add_sensors(void)
+ {
+     static char labels[ACER_WMI_MAX_SENSORS][16];
+     unsigned long mask = supported_sensors;
+     enum acer_wmi_predator_v4_sensor_id sensor_id;
+     int bit, channel;
+ 
+     for_each_set_bit(bit, &mask, ACER_WMI_MAX_SENSORS) {
+         sensor_id = bit + 1;
+         if (acer_wmi_sensor_known(sensor_id) ||
+             acer_wmi_temp_channels == ACER_WMI_MAX_SENSORS)
+             continue;
+ 
+         channel = acer_wmi_temp_channels++;
+         snprintf(labels[channel], sizeof(labels[channel]), "sensor%d", sensor_id);
+         acer_wmi_temp_channel_to_sensor_id[channel] = sensor_id;
+         acer_wmi_temp_labels[channel] = labels[channel];
+         pr_info("Unknown sensor %d exposed as temp%d\n", sensor_id, channel + 1);
+     }
+ 
+     for (channel = 0; channel < acer_wmi_temp_channels; channel++)
+         acer_wmi_temp_config[channel] = HWMON_T_INPUT | HWMON_T_LABEL | HWMON_T_HIGHEST |
+                                         HWMON_T_LOWEST | HWMON_T_RESET_HISTORY;
+     for (channel = 0; channel < acer_wmi_fan_channels; channel++)
+         acer_wmi_fan_config[channel] = HWMON_F_INPUT | HWMON_F_LABEL | HWMON_F_MAX;
+ }
+ 
+ /*
+  * hwmon has no fan reset_history, so the fan peaks (fanX_max) get their own
+  * chip level attribute next to temp_reset_history.
+  */
+ static ssize_t acer_wmi_fan_reset_history_store(struct device *dev, struct device_attribute *attr,
+                                                 const char *buf, size_t count)
+ {
+     long val;
+ 
+     if (kstrtol(buf, 10, &val))
+         return -EINVAL;
+     acer_wmi_history_reset(acer_wmi_fan_history, acer_wmi_fan_channels);
+     return count;
+ }
+ 
+ static struct device_attribute acer_wmi_fan_reset_history =
+     __ATTR(fan_reset_history, 0200, NULL, acer_wmi_fan_reset_history_store);
+ 
+ static struct attribute *acer_wmi_hwmon_attrs[] = {
+     &acer_wmi_fan_reset_history.attr,
+     NULL
+ };
+ 
+ static const struct attribute_group acer_wmi_hwmon_group = {
+     .attrs = acer_wmi_hwmon_attrs,
+ };
+ 
+ static const struct attribute_group *acer_wmi_hwmon_groups[] = {
+     &acer_wmi_hwmon_group,
+     NULL
+ };
+ 
  static int acer_wmi_hwmon_init(void)
  {
      struct device *dev = &acer_platform_device->dev;
@@ -4375,16 +8385,19 @@ static const enum acer_wmi_predator_v4_sensor_id acer_wmi_fan_channel_to_sensor_
      if (!supported_sensors)
          return 0;
  
+     acer_wmi_hwmon_add_sensors();
+ 
      hwmon = devm_hwmon_device_register_with_info(dev, "acer",
                               &supported_sensors,
                               &acer_wmi_hwmon_chip_info,
-                              NULL);
+                              acer_wmi_hwmon_groups);
  
      if (IS_ERR(hwmon)) {
          dev_err(dev, "Could not register acer hwmon device\n");
          return PTR_ERR(hwmon);
      }
  
+     acer_wmi_hwmon_sample_start();
      return 0;
  }
  